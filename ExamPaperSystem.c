@@ -7,11 +7,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <limits.h>
 
 #ifdef LOGME_WINDOWS
 
 #include <windows.h>
 #include "tcpserver.h"
+#include "vsha256.h"
 #include "kbhook.h"
 #include "db.c"
 
@@ -110,73 +112,21 @@ int my_run(vlist this, long i, void* extra) {
     return i > 8;
 }
 
-enum PAPER_FILENAME_ARRAY_INDEX {
-    FILE_NAME_INDEX = 0,
-    DOWNLOAD_NAME_INDEX,
-    MIME_TYPE_INDEX,
-    FILE_CHARSET_INDEX
-};
-const char* const paper_filenames[][4] = {
-    {"D:\\同步盘\\Documents\\各种标准文档\\C++17官方标准文档Plus\\ISOIEC 14882 2017.pdf", "C++开发测试题.pdf", MIME_TYPE_PDF, HTTP_CHARSET_UTF8},
-    {"D:\\同步盘\\Documents\\各种标准文档\\Wi-Fi_Display_Technical_Specification_v2.1_0.pdf", "硬件开发测试题.pdf", MIME_TYPE_PDF, HTTP_CHARSET_UTF8}
-};
-
-enum EXAM_START_TIMESTAMPS_S_ARRAY_INDEX {
-    EXAM_START_TS_INDEX = 0,
-    EXAM_DURATION_INDEX
-};
-const long long exam_start_timestamps_s[][2] = {
-    {1621494000LL, 7200LL},
-    {1621497600LL, 7200LL}
-};
-
-int get_exam_id(int position) {
-    if (position & 1)
-    {
-        return 0;
-    }
-    else
-    {
-        return 1;
-    }
-}
-
-// do not return relative path!
-const char *get_exam_dir(int position) {
-    if (position & 1)
-    {
-        return "E:\\exam0\\";
-    }
-    else
-    {
-        return "E:\\exam1\\";
-    }
-}
-
-typedef struct FindQuery {
-    const char* expected_field;
-    const char* value;
-} FindQuery;
-
-int find_query(vlist this_vlist, long i, void* extra) {
-    FindQuery* fq = extra;
-    KeyValuePair* kv = this_vlist->get(this_vlist, i);
-    if (strlen(kv->field) == strlen(fq->expected_field) && strstr(kv->field, fq->expected_field))
+// 从 query string 中取出非负整数 pos，失败返回 -1
+int find_query_pos(const HttpMessageView* hmsg) {
+    int pos = -1;
+    if (!http_view_query_int(hmsg, "pos", &pos) || pos < 0)
     {
-        fq->value = kv->value;
+        return -1;
     }
-    return 0; // go on
+    return pos;
 }
 
 #ifdef LOGME_WINDOWS
-int get_paper(HttpMessage* hmsg, HttpHandlerPac* hpac) {
-    FindQuery fq = {
-        .expected_field = "pos",
-        .value = NULL
-    };
-    if (!hmsg->query_string)
-    {
-    handle_400:
+int get_paper(const HttpMessageView* hmsg, HttpHandlerPac* hpac) {
+    int pos = find_query_pos(hmsg);
+    if (pos < 0)
+    {
         if (
             send_text(
                 hpac->node,
@@ -195,21 +145,15 @@ int get_paper(HttpMessage* hmsg, HttpHandlerPac* hpac) {
         }
         return 2;
     }
-    hmsg->query_string->foreach(hmsg->query_string, find_query, &fq);
-    int pos = -1;
-    if (!fq.value || (sscanf(fq.value, "%d", &pos), pos < 0))
-    {
-        goto handle_400;
-    }
     int return_value = 1;
-    Paper paper = db_get_paper(pos);
+    Paper paper = db_get_paper(hpac->arena, pos);
     if (paper.valid)
     {
         char encoded_name[500];
         const char* dlname = paper.dl_name;
         url_encode(dlname, strlen(dlname), encoded_name, sizeof(encoded_name), 0);
         if (
-            send_file(
+            send_cached_file(
                 hpac->node,
                 paper.path,
                 1,
@@ -243,14 +187,10 @@ clean:
     return return_value;
 }
 
-int get_exam_time(HttpMessage* hmsg, HttpHandlerPac* hpac) {
-    FindQuery fq = {
-        .expected_field = "pos",
-        .value = NULL
-    };
-    if (!hmsg->query_string)
+int get_exam_time(const HttpMessageView* hmsg, HttpHandlerPac* hpac) {
+    int pos = find_query_pos(hmsg);
+    if (pos < 0)
     {
-    handle_400:
         if (
             send_text(
                 hpac->node,
@@ -269,17 +209,19 @@ int get_exam_time(HttpMessage* hmsg, HttpHandlerPac* hpac) {
         }
         return 2;
     }
-    hmsg->query_string->foreach(hmsg->query_string, find_query, &fq);
-    int pos = -1;
-    if (!fq.value || (sscanf(fq.value, "%d", &pos), pos < 0))
-    {
-        goto handle_400;
-    }
-    int eid = get_exam_id(pos);
     time_t raw_timestamp_s;
     time(&raw_timestamp_s);
-    long long exam_time_s = exam_start_timestamps_s[eid][EXAM_START_TS_INDEX];
-    long long exam_duration_s = exam_start_timestamps_s[eid][EXAM_DURATION_INDEX];
+    long long exam_time_s = 0;
+    long long exam_duration_s = 0;
+    // 座位正在进行的考试，没有时是下一场考试，都没有时是最后一场考试
+    if (!db_get_exam_time(pos, raw_timestamp_s, &exam_time_s, &exam_duration_s))
+    {
+        if (send_text(hpac->node, 404, REASON_PHRASE_404, 1, HTML_404, MIME_TYPE_HTML, HTTP_CHARSET_UTF8, 0, NULL))
+        {
+            return -99;
+        }
+        return 2;
+    }
     char response_body[150] = { 0 };
     snprintf(response_body, sizeof(response_body), "%lld %lld %lld", (long long)raw_timestamp_s, exam_time_s, exam_duration_s);
     if (
@@ -301,12 +243,9 @@ int get_exam_time(HttpMessage* hmsg, HttpHandlerPac* hpac) {
     return 1;
 }
 
-int hand_in_paper(HttpMessage* hmsg, HttpHandlerPac* hpac) {
-    FindQuery fq = {
-        .expected_field = "pos",
-        .value = NULL
-    };
-    if (!hmsg->query_string)
+int hand_in_paper(const HttpMessageView* hmsg, HttpHandlerPac* hpac) {
+    int pos = find_query_pos(hmsg);
+    if (pos < 0)
     {
     handle_404:
         if (
@@ -327,38 +266,49 @@ int hand_in_paper(HttpMessage* hmsg, HttpHandlerPac* hpac) {
         }
         return 2;
     }
-    hmsg->query_string->foreach(hmsg->query_string, find_query, &fq);
-    int pos = -1;
-    if (!fq.value || (sscanf(fq.value, "%d", &pos), pos < 0))
+    if (!http_slice_equal(http_view_query(hmsg, "pwd"), HAND_IN_PAPER_PWD))
+    {
+        goto handle_404;
+    }
+    // 座位正在进行的考试的结果文件夹，没有时是最近开始的那场考试的，考试结束后仍然可以续传
+    const char* exam_dir = db_get_exam_dir(hpac->arena, pos, time(NULL));
+    if (!exam_dir)
     {
         goto handle_404;
     }
-    int eid = get_exam_id(pos);
-    fq = (FindQuery){
-        .expected_field = "pwd",
-        .value = NULL
-    };
-    hmsg->query_string->foreach(hmsg->query_string, find_query, &fq);
-    if (!fq.value || strcmp(fq.value, HAND_IN_PAPER_PWD))
+    char filename[1024];
+    if (!http_slice_copy(http_view_query(hmsg, "fn"), filename, sizeof(filename)))
     {
         goto handle_404;
     }
-    fq = (FindQuery){
-        .expected_field = "fn",
-        .value = NULL
-    };
-    hmsg->query_string->foreach(hmsg->query_string, find_query, &fq);
-    if (!fq.value)
+    // HEAD 查询已经收到的字节数，客户端从这个偏移继续上传
+    if (hmsg->method == HEAD)
+    {
+        if (send_received_file_offset(hpac->node, exam_dir, filename, 1, REASON_PHRASE_200, REASON_PHRASE_404) < 0)
+        {
+            return -99;
+        }
+        return 1;
+    }
+    long long offset = 0;
+    if (http_view_query(hmsg, "offset").at && (!http_view_query_ll(hmsg, "offset", &offset) || offset < 0))
     {
         goto handle_404;
     }
-    const char* filename = fq.value;
-    if (hmsg->content_length <= 0)
+    // 续传时 body 可以为空（文件已经全部收到，只是没有收到回复）
+    if (hmsg->content_length < 0 || (hmsg->content_length == 0 && offset == 0))
     {
-        LogMe.et("hand_in_paper() get <=0 content-length [content-length=%lld]", hmsg->content_length);
+        LogMe.et("hand_in_paper() get invalid content-length [content-length=%lld] [offset=%lld]", hmsg->content_length, offset);
         goto handle_404;
     }
-    int rfres = receive_file(hpac->node, get_exam_dir(pos), filename, 1, hmsg->content_length
+    // 客户端提供了 SHA-256 时，服务器收完文件后校验
+    char sha256[VSHA256_HEX_SIZE];
+    HttpSlice sha256_slice = http_view_header(hmsg, HTTP_HEADER_CONTENT_SHA256);
+    if (sha256_slice.at && !http_slice_copy(sha256_slice, sha256, sizeof(sha256)))
+    {
+        goto handle_404;
+    }
+    int rfres = receive_file(hpac->node, exam_dir, filename, 1, hmsg->content_length, offset, sha256_slice.at ? sha256 : NULL
         , REASON_PHRASE_200
         , HTML_200
         , REASON_PHRASE_500
@@ -368,6 +318,11 @@ int hand_in_paper(HttpMessage* hmsg, HttpHandlerPac* hpac) {
     {
         return -98;
     }
+    else if (rfres == 2)
+    {
+        // body 没有被读取，不能再解析后面的请求
+        return INT_MAX;
+    }
     return 1;
 }
 
@@ -389,6 +344,13 @@ const void* const extras[] = {
     NULL
 };
 
+// 考试快结束时，提交优先于重新下载试卷和轮询考试时间
+const HttpPriorityClass priorities[] = {
+    HTTP_PRIORITY_BULK,
+    HTTP_PRIORITY_LOW,
+    HTTP_PRIORITY_URGENT
+};
+
 int generate_http_handlers(vlist hlist) {
     int path_num = sizeof(url_path_patterns) / sizeof(const char*);
     for (int i = 0; i < path_num; i++)
@@ -402,9 +364,301 @@ int generate_http_handlers(vlist hlist) {
         hhd->path_contains = url_path_patterns[i];
         hhd->handle_func = procs[i];
         hhd->extra = extras[i];
+        hhd->priority_class = priorities[i];
     }
     return 1;
 }
+
+#define PAPER_WARMUP_LEAD_MIN 10 // 考试开始前多少分钟开始预热试卷
+#define PAPER_WARMUP_POLL_MS 30000 // 预热线程检查即将开始的考试的间隔
+
+// 等待下一轮：超时或 wake_event 被触发时返回非零，stop_event 被触发时返回 0
+static int wait_next_round(HANDLE stop_event, HANDLE wake_event, DWORD wait_ms) {
+    HANDLE events[] = { stop_event, wake_event };
+    DWORD wait_result = WaitForMultipleObjects(2, events, FALSE, wait_ms);
+    return wait_result == WAIT_TIMEOUT || wait_result == WAIT_OBJECT_0 + 1;
+}
+
+// 已预热的（考试，试卷），同一场考试的试卷只预热一次，考试结束后移除
+typedef struct WarmedPaper {
+    VLISTNODE
+    long long eid;
+    long long pid;
+    long long start_ts;
+    long long end_ts;
+} WarmedPaper;
+
+typedef struct PaperWarmup {
+    HANDLE thread;
+    HANDLE stop_event;
+    // 考试安排变化时触发，预热线程立即开始下一轮
+    HANDLE wake_event;
+    int lead_min;
+    vlist warmed;
+} PaperWarmup;
+
+typedef struct FindWarmed {
+    const UpcomingPaper* up;
+    int found;
+} FindWarmed;
+
+static int find_warmed(vlist this_vlist, long i, void* extra) {
+    const WarmedPaper* wp = this_vlist->get_const(this_vlist, i);
+    FindWarmed* fw = extra;
+    fw->found = wp->eid == fw->up->eid && wp->pid == fw->up->pid && wp->start_ts == fw->up->start_ts;
+    return fw->found;
+}
+
+static int warm_paper(vlist this_vlist, long i, void* extra) {
+    const UpcomingPaper* up = this_vlist->get_const(this_vlist, i);
+    PaperWarmup* pw = extra;
+    FindWarmed fw = { .up = up, .found = 0 };
+    pw->warmed->foreach(pw->warmed, find_warmed, &fw);
+    if (fw.found)
+    {
+        return 0; // go on
+    }
+    ULONGLONG start_tick = GetTickCount64();
+    unsigned long long size = 0;
+    if (preload_cached_file(up->path, &size) != 0)
+    {
+        // 下一轮再试
+        LogMe.wt("paper warmup: [exam %lld ] [paper %lld \"%s\" ] could not be preloaded, retry later", up->eid, up->pid, up->path);
+        return 0; // go on
+    }
+    LogMe.it("paper warmup: [exam %lld starts in %lld s] [paper %lld \"%s\" ] <Size: %llu> preloaded for %d seats in %llu ms"
+        , up->eid, up->start_ts - (long long)time(NULL), up->pid, up->path, size, up->pos_num, GetTickCount64() - start_tick);
+    WarmedPaper wp = { .eid = up->eid, .pid = up->pid, .start_ts = up->start_ts, .end_ts = up->end_ts };
+    pw->warmed->add(pw->warmed, &wp);
+    return 0; // go on
+}
+
+// return zero to remove current node from vlist
+static int unfinished_exam_filter(vlist this_vlist, long i, void* extra) {
+    return ((const WarmedPaper*)this_vlist->get_const(this_vlist, i))->end_ts >= *(long long*)extra;
+}
+
+// 定期查询正在进行或 lead_min 分钟内开始的考试，把它们的试卷预先加载到文件缓存中
+static DWORD WINAPI paper_warmup_run(_In_ LPVOID param) {
+    PaperWarmup* pw = param;
+    do
+    {
+        ULONGLONG start_tick = GetTickCount64();
+        long long now_ts = time(NULL);
+        vlist papers = db_get_upcoming_papers(now_ts, now_ts + pw->lead_min * 60LL);
+        if (!papers)
+        {
+            LogMe.et("paper warmup: could not query upcoming exams");
+            continue;
+        }
+        long warmed_before = pw->warmed->size;
+        papers->foreach(papers, warm_paper, pw);
+        if (pw->warmed->size != warmed_before)
+        {
+            LogMe.it("paper warmup: %ld new papers of %ld upcoming papers warmed in %llu ms"
+                , pw->warmed->size - warmed_before, papers->size, GetTickCount64() - start_tick);
+        }
+        db_delete_upcoming_papers(papers, &papers);
+        pw->warmed->flush(pw->warmed, unfinished_exam_filter, &now_ts);
+    } while (wait_next_round(pw->stop_event, pw->wake_event, PAPER_WARMUP_POLL_MS));
+    return 0;
+}
+
+// 启动试卷预热线程，成功返回 1，失败返回 0
+int start_paper_warmup(PaperWarmup* pw, int lead_min) {
+    *pw = (PaperWarmup){ .lead_min = lead_min };
+    pw->warmed = make_vlist(sizeof(WarmedPaper));
+    pw->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    pw->wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (pw->warmed && pw->stop_event && pw->wake_event)
+    {
+        pw->thread = CreateThread(NULL, 0, paper_warmup_run, pw, 0, NULL);
+    }
+    if (!pw->thread)
+    {
+        LogMe.et("paper warmup: could not start the warmup thread");
+        if (pw->stop_event)
+        {
+            CloseHandle(pw->stop_event); pw->stop_event = NULL;
+        }
+        if (pw->wake_event)
+        {
+            CloseHandle(pw->wake_event); pw->wake_event = NULL;
+        }
+        delete_vlist(pw->warmed, &pw->warmed);
+        return 0;
+    }
+    LogMe.it("paper warmup: papers are preloaded %d minutes before their exams start", lead_min);
+    return 1;
+}
+
+// 通知预热线程退出并等待它结束，必须在 db_close() 之前调用
+void stop_paper_warmup(PaperWarmup* pw) {
+    if (!pw->thread)
+    {
+        return;
+    }
+    SetEvent(pw->stop_event);
+    WaitForSingleObject(pw->thread, INFINITE);
+    CloseHandle(pw->thread); pw->thread = NULL;
+    CloseHandle(pw->stop_event); pw->stop_event = NULL;
+    CloseHandle(pw->wake_event); pw->wake_event = NULL;
+    delete_vlist(pw->warmed, &pw->warmed);
+}
+
+#define HANDIN_PRIORITY_WINDOW_MIN 10 // 考试结束前多少分钟开始优先处理提交
+#define HANDIN_PRIORITY_GRACE_S 120 // 考试结束后继续优先处理提交的秒数，让最后一刻开始的提交能够收完
+#define HANDIN_PRIORITY_BULK_SLOTS 4 // 优先处理提交期间最多同时发送几份试卷
+#define HANDIN_PRIORITY_BULK_BYTES_PER_S (2ULL * 1024ULL * 1024ULL) // 优先处理提交期间所有试卷下载共享的发送速率上限
+#define DEADLINE_WATCH_POLL_MS 30000 // 截止时间监视线程检查考试安排的最大间隔
+
+typedef struct DeadlineWatch {
+    HANDLE thread;
+    HANDLE stop_event;
+    // 考试安排变化时触发，监视线程立即重新计算
+    HANDLE wake_event;
+    int window_min;
+} DeadlineWatch;
+
+// 根据考试安排开关服务器的截止模式：任意一场考试在 window_min 分钟内结束（或结束不到 HANDIN_PRIORITY_GRACE_S 秒）时，
+// 提交请求优先，试卷下载和考试时间轮询让路。在下一次需要切换的时刻醒来，最长等待 DEADLINE_WATCH_POLL_MS，以便发现新加的考试
+static DWORD WINAPI deadline_watch_run(_In_ LPVOID param) {
+    DeadlineWatch* dw = param;
+    DWORD wait_ms;
+    do
+    {
+        wait_ms = DEADLINE_WATCH_POLL_MS;
+        long long now_ts = time(NULL);
+        long long end_ts = 0;
+        int found = db_get_next_exam_end(now_ts - HANDIN_PRIORITY_GRACE_S, &end_ts);
+        if (found < 0)
+        {
+            // 保持当前模式，下一轮再试
+            LogMe.et("deadline watch: could not query exam deadlines");
+            continue;
+        }
+        long long on_ts = end_ts - dw->window_min * 60LL;
+        int on = found && now_ts >= on_ts;
+        // 下一次切换的时刻：开启时是宽限期结束，关闭时是进入窗口
+        long long switch_ts = on ? end_ts + HANDIN_PRIORITY_GRACE_S + 1 : on_ts;
+        if (on)
+        {
+            LogMe.it("deadline watch: an exam ends in %lld s, hand-ins take priority", end_ts - now_ts);
+        }
+        if (found && (switch_ts - now_ts) * 1000LL < wait_ms)
+        {
+            wait_ms = (DWORD)((switch_ts - now_ts) * 1000LL);
+        }
+        tcp_server_set_deadline_mode(on, HANDIN_PRIORITY_BULK_SLOTS, HANDIN_PRIORITY_BULK_BYTES_PER_S);
+    } while (wait_next_round(dw->stop_event, dw->wake_event, wait_ms));
+    tcp_server_set_deadline_mode(0, HANDIN_PRIORITY_BULK_SLOTS, HANDIN_PRIORITY_BULK_BYTES_PER_S);
+    return 0;
+}
+
+// 启动截止时间监视线程，成功返回 1，失败返回 0
+int start_deadline_watch(DeadlineWatch* dw, int window_min) {
+    *dw = (DeadlineWatch){ .window_min = window_min };
+    dw->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    dw->wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (dw->stop_event && dw->wake_event)
+    {
+        dw->thread = CreateThread(NULL, 0, deadline_watch_run, dw, 0, NULL);
+    }
+    if (!dw->thread)
+    {
+        LogMe.et("deadline watch: could not start the watch thread");
+        if (dw->stop_event)
+        {
+            CloseHandle(dw->stop_event); dw->stop_event = NULL;
+        }
+        if (dw->wake_event)
+        {
+            CloseHandle(dw->wake_event); dw->wake_event = NULL;
+        }
+        return 0;
+    }
+    LogMe.it("deadline watch: hand-ins take priority %d minutes before their exams end", window_min);
+    return 1;
+}
+
+// 通知监视线程退出并等待它结束，必须在 db_close() 之前调用
+void stop_deadline_watch(DeadlineWatch* dw) {
+    if (!dw->thread)
+    {
+        return;
+    }
+    SetEvent(dw->stop_event);
+    WaitForSingleObject(dw->thread, INFINITE);
+    CloseHandle(dw->thread); dw->thread = NULL;
+    CloseHandle(dw->stop_event); dw->stop_event = NULL;
+    CloseHandle(dw->wake_event); dw->wake_event = NULL;
+}
+
+#define SCHEDULE_WATCH_POLL_MS 1000 // 检查数据库是否被修改的间隔
+
+typedef struct ScheduleWatch {
+    HANDLE thread;
+    HANDLE stop_event;
+    // 考试安排变化后需要唤醒的线程，没有启动的线程不会被唤醒
+    PaperWarmup* paper_warmup;
+    DeadlineWatch* deadline_watch;
+} ScheduleWatch;
+
+// 定期检查数据库是否被修改（例如用 sqlite3.exe 改了考试时间），有变化时在这个线程里重建考试安排的内存快照并发布，
+// 请求线程下一次查找时就会看到新的安排，不需要重启服务器，也不会等待重建；然后唤醒预热线程和截止时间监视线程按新的安排重新计算
+static DWORD WINAPI schedule_watch_run(_In_ LPVOID param) {
+    ScheduleWatch* sw = param;
+    do
+    {
+        if (db_reload_schedule_if_changed() <= 0)
+        {
+            // 没有变化，或者重建失败，保留当前的快照，下一轮再试
+            continue;
+        }
+        if (sw->paper_warmup->thread)
+        {
+            SetEvent(sw->paper_warmup->wake_event);
+        }
+        if (sw->deadline_watch->thread)
+        {
+            SetEvent(sw->deadline_watch->wake_event);
+        }
+    } while (WaitForSingleObject(sw->stop_event, SCHEDULE_WATCH_POLL_MS) == WAIT_TIMEOUT);
+    return 0;
+}
+
+// 启动考试安排监视线程，成功返回 1，失败返回 0
+int start_schedule_watch(ScheduleWatch* sw, PaperWarmup* pw, DeadlineWatch* dw) {
+    *sw = (ScheduleWatch){ .paper_warmup = pw, .deadline_watch = dw };
+    sw->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (sw->stop_event)
+    {
+        sw->thread = CreateThread(NULL, 0, schedule_watch_run, sw, 0, NULL);
+    }
+    if (!sw->thread)
+    {
+        LogMe.et("schedule watch: could not start the watch thread, the schedule is not reloaded until restart");
+        if (sw->stop_event)
+        {
+            CloseHandle(sw->stop_event); sw->stop_event = NULL;
+        }
+        return 0;
+    }
+    LogMe.it("schedule watch: the schedule is reloaded within %d ms after the database changes", SCHEDULE_WATCH_POLL_MS);
+    return 1;
+}
+
+// 通知监视线程退出并等待它结束，必须在 stop_paper_warmup()、stop_deadline_watch() 和 db_close() 之前调用
+void stop_schedule_watch(ScheduleWatch* sw) {
+    if (!sw->thread)
+    {
+        return;
+    }
+    SetEvent(sw->stop_event);
+    WaitForSingleObject(sw->thread, INFINITE);
+    CloseHandle(sw->thread); sw->thread = NULL;
+    CloseHandle(sw->stop_event); sw->stop_event = NULL;
+}
 #endif // LOGME_WINDOWS
 
 int main()
@@ -494,7 +748,7 @@ int main()
 #ifdef TEST_SQLITE3
     db_init();
     int pos = 1;
-    Paper paper = db_get_paper(pos);
+    Paper paper = db_get_paper(NULL, pos);
     if (paper.valid)
     {
         LogMe.b("[paper for pos %d ] fp = %s, mime = %s, fn = %s", pos, paper.path, paper.mime_type, paper.dl_name);
@@ -505,7 +759,7 @@ int main()
     }
     db_deletePaper(&paper);
     pos = 0;
-    paper = db_get_paper(pos);
+    paper = db_get_paper(NULL, pos);
     if (paper.valid)
     {
         LogMe.b("[paper for pos %d ] fp = %s, mime = %s, fn = %s", pos, paper.path, paper.mime_type, paper.dl_name);
@@ -525,7 +779,18 @@ int main()
         LogMe.et("Malloc failed when generating HTTP handlers");
         return -1;
     }
-    db_init();
+    if (!db_init())
+    {
+        LogMe.et("Could not open the database");
+        delete_vlist(handlers, &handlers);
+        return -1;
+    }
+    PaperWarmup paper_warmup;
+    start_paper_warmup(&paper_warmup, PAPER_WARMUP_LEAD_MIN);
+    DeadlineWatch deadline_watch;
+    start_deadline_watch(&deadline_watch, HANDIN_PRIORITY_WINDOW_MIN);
+    ScheduleWatch schedule_watch;
+    start_schedule_watch(&schedule_watch, &paper_warmup, &deadline_watch);
     tcp_server_run(23456, 1, handlers
         , REASON_PHRASE_200
         , HTML_200
@@ -534,6 +799,9 @@ int main()
         , REASON_PHRASE_500
         , HTML_500
     );
+    stop_schedule_watch(&schedule_watch);
+    stop_deadline_watch(&deadline_watch);
+    stop_paper_warmup(&paper_warmup);
     db_close();
     delete_vlist(handlers, &handlers);
 #endif // LOGME_WINDOWS
@@ -1,40 +1,803 @@
 #define db_file_name "ExamPaperSystem.db"
+#define db_slow_run_us 50000LL // runs slower than this are logged one by one
+#define db_mmap_size 268435456LL // bytes of the database file every connection reads through mmap
+#define db_busy_timeout_ms 5000 // how long the writer waits for a lock before giving up
+#define db_schedule_grace_s 60 // a replaced schedule snapshot is freed no earlier than this long after the replacement
+#define db_schedule_arena_block_size 65536
+#define db_schedule_max_pos 1000000 // seats above this are left out of the schedule, which has an entry for every seat up to the last one
 
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "sqlite3.h"
 #include "vutils.h"
+#include "logme.h"
+
+#ifdef LOGME_WINDOWS
+#include <windows.h>
+#endif // LOGME_WINDOWS
 
-typedef sqlite3* Database;
 typedef struct Paper {
 	int valid;
 	char* path;
 	char* mime_type;
 	char* dl_name;
+	// non-NULL when the strings were allocated from this arena, db_deletePaper() leaves them to the arena
+	varena arena;
 } Paper;
 
-volatile Database db = NULL;
+// every query is prepared once per connection and reused with sqlite3_reset()/sqlite3_clear_bindings(),
+// so requests do not pay for SQL compilation.
+typedef enum DbStmtId {
+	STMT_GET_SCHEDULE = 0,
+	STMT_GET_UPCOMING_PAPERS,
+	STMT_GET_NEXT_EXAM_END,
+	STMT_GET_DATA_VERSION,
+	STMT_NUM
+} DbStmtId;
+
+typedef struct DbStmtInfo {
+	const char* name;
+	const char* sql;
+	// non-zero for statements that modify the database, they run on the writer connection
+	int writes;
+	// non-zero for statements that run on the watcher connection
+	int watches;
+} DbStmtInfo;
+
+static const DbStmtInfo db_stmt_infos[STMT_NUM] = {
+	[STMT_GET_SCHEDULE] = {
+		.name = "get_schedule",
+		.sql = "select pe.pos, e.id, e.start_ts, e.start_ts+e.duration_s, p.id, p.file_path, p.mime_type, p.name, r.dir_path, pe.sub_res_dir_name from "
+			"pos_exam pe join exam e on pe.eid=e.id left join paper p on pe.pid=p.id left join resdir r on pe.rid=r.id "
+			"where pe.pos>=0 order by pe.pos, e.start_ts;"
+	},
+	[STMT_GET_UPCOMING_PAPERS] = {
+		.name = "get_upcoming_papers",
+		.sql = "select e.id, p.id, e.start_ts, e.start_ts+e.duration_s, p.file_path, p.mime_type, p.name, count(pe.pos) from "
+			"exam e, pos_exam pe, paper p "
+			"where pe.eid=e.id and pe.pid=p.id and e.start_ts+e.duration_s>=@now and e.start_ts<=@until "
+			"group by e.id, p.id order by e.start_ts;"
+	},
+	[STMT_GET_NEXT_EXAM_END] = {
+		.name = "get_next_exam_end",
+		.sql = "select min(start_ts+duration_s) from exam where start_ts+duration_s>=@since;"
+	},
+	[STMT_GET_DATA_VERSION] = {
+		.name = "get_data_version",
+		// changes whenever another connection, in this process or another one, commits to the database
+		.sql = "pragma data_version;",
+		.watches = 1
+	}
+};
+
+// a prepared statement of one connection
+typedef struct DbStmt {
+	sqlite3_stmt* stmt;
+	// timings in microseconds, a run is everything between db_acquire_stmt() and db_release_stmt()
+	long long prepare_us;
+	long long runs;
+	long long run_us;
+	long long max_run_us;
+} DbStmt;
+
+typedef struct DbConn {
+	sqlite3* handle;
+	DbStmt stmts[STMT_NUM];
+	// next connection in the free list of read connections
+	struct DbConn* next_free;
+	// next connection in the list of all read connections
+	struct DbConn* next;
+} DbConn;
+
+// the database is opened in WAL mode, so readers never block each other or the writer.
+// read-only connections are handed out to one thread at a time, which then uses it without any locking;
+// a new one is opened when every open one is busy, so there are as many as threads querying at the same time.
+// writes go through the single writer connection, which serializes its users with its own mutex.
+static DbConn* db_writer = NULL;
+// a read-only connection that detects changes to the database, only used by the thread calling db_reload_schedule_if_changed().
+// data_version is per connection, so it has to be asked on the same connection every time
+static DbConn* db_watcher = NULL;
+// data_version the current schedule snapshot was built at
+static long long db_schedule_data_version = -1;
+static DbConn* db_readers = NULL;
+static DbConn* db_free_readers = NULL;
+static int db_reader_num = 0;
+// guards db_readers, db_free_readers and db_reader_num
+static sqlite3_mutex* db_pool_mutex = NULL;
+// serializes schedule reloads
+static sqlite3_mutex* db_reload_mutex = NULL;
+
+// a run of a statement, from db_acquire_stmt() to db_release_stmt()
+typedef struct DbRun {
+	DbStmtId id;
+	DbConn* conn;
+	long long start_us;
+} DbRun;
+
+static long long db_now_us() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// opens a connection and sets it up, returns NULL on failure
+static DbConn* db_open_conn(int flags) {
+	DbConn* conn = zero_malloc(sizeof(DbConn));
+	if (!conn)
+	{
+		return NULL;
+	}
+	if (sqlite3_open_v2(db_file_name, &conn->handle, flags, NULL) != SQLITE_OK)
+	{
+		LogMe.et("db: could not open %s: %s", db_file_name, conn->handle ? sqlite3_errmsg(conn->handle) : "out of memory");
+		sqlite3_close(conn->handle);
+		free(conn);
+		return NULL;
+	}
+	sqlite3_busy_timeout(conn->handle, db_busy_timeout_ms);
+	char pragma[64];
+	snprintf(pragma, sizeof(pragma), "pragma mmap_size=%lld;", db_mmap_size);
+	if (sqlite3_exec(conn->handle, pragma, NULL, NULL, NULL) != SQLITE_OK)
+	{
+		LogMe.wt("db: could not enable mmap I/O: %s", sqlite3_errmsg(conn->handle));
+	}
+	return conn;
+}
+
+static void db_close_conn(DbConn* conn) {
+	for (int i = 0; i < STMT_NUM; i++)
+	{
+		// the connection cannot be closed while it has unfinalized statements
+		sqlite3_finalize(conn->stmts[i].stmt);
+	}
+	if (sqlite3_close(conn->handle) != SQLITE_OK)
+	{
+		LogMe.et("db: could not close a connection: %s", sqlite3_errmsg(conn->handle));
+	}
+	free(conn);
+}
+
+// takes a free read connection, opening a new one when all of them are in use. returns NULL on failure
+static DbConn* db_acquire_reader() {
+	sqlite3_mutex_enter(db_pool_mutex);
+	DbConn* conn = db_free_readers;
+	if (conn)
+	{
+		db_free_readers = conn->next_free;
+	}
+	sqlite3_mutex_leave(db_pool_mutex);
+	if (conn)
+	{
+		return conn;
+	}
+	// one connection per thread, sqlite does not have to lock it
+	conn = db_open_conn(SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX);
+	if (!conn)
+	{
+		return NULL;
+	}
+	sqlite3_mutex_enter(db_pool_mutex);
+	conn->next = db_readers;
+	db_readers = conn;
+	int reader_num = ++db_reader_num;
+	sqlite3_mutex_leave(db_pool_mutex);
+	LogMe.it("db: opened read connection #%d", reader_num);
+	return conn;
+}
+
+static void db_release_reader(DbConn* conn) {
+	sqlite3_mutex_enter(db_pool_mutex);
+	conn->next_free = db_free_readers;
+	db_free_readers = conn;
+	sqlite3_mutex_leave(db_pool_mutex);
+}
+
+static void db_add_stmt_stats(DbStmt* sum, int* prepares, const DbStmt* ds) {
+	*prepares += ds->stmt != NULL;
+	sum->prepare_us += ds->prepare_us;
+	sum->runs += ds->runs;
+	sum->run_us += ds->run_us;
+	sum->max_run_us = ds->max_run_us > sum->max_run_us ? ds->max_run_us : sum->max_run_us;
+}
 
-// must be called from single thread environment!
-void db_init() {
-	while (sqlite3_open(db_file_name, &db) != SQLITE_OK);
+// logs how long each statement took to prepare and to run, summed over all connections.
+// the numbers of connections that are in use at the moment may lag behind a little
+void db_log_stmt_stats() {
+	if (!db_writer)
+	{
+		return;
+	}
+	sqlite3_mutex_enter(db_pool_mutex);
+	for (int i = 0; i < STMT_NUM; i++)
+	{
+		DbStmt sum = { 0 };
+		int prepares = 0;
+		db_add_stmt_stats(&sum, &prepares, &db_writer->stmts[i]);
+		if (db_watcher)
+		{
+			db_add_stmt_stats(&sum, &prepares, &db_watcher->stmts[i]);
+		}
+		for (DbConn* conn = db_readers; conn; conn = conn->next)
+		{
+			db_add_stmt_stats(&sum, &prepares, &conn->stmts[i]);
+		}
+		if (sum.runs > 0)
+		{
+			LogMe.it("db statement %s: prepared on %d connections in %lld us on average, %lld runs, %lld us on average, %lld us at most"
+				, db_stmt_infos[i].name, prepares, prepares ? sum.prepare_us / prepares : 0, sum.runs, sum.run_us / sum.runs, sum.max_run_us);
+		}
+	}
+	sqlite3_mutex_leave(db_pool_mutex);
+}
+
+static long long db_get_data_version();
+int db_reload_schedule();
+static void db_free_schedules();
+void db_close();
+
+// opens the writer and the watcher connection and switches the database to WAL mode, read connections are opened on demand,
+// then loads the schedule snapshot. returns 1 on success, 0 on failure. must be called from single thread environment!
+int db_init() {
+	if (db_writer)
+	{
+		return 1;
+	}
+	db_writer = db_open_conn(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX);
+	if (!db_writer)
+	{
+		return 0;
+	}
+	// the journal mode is stored in the database file, this only does work the first time
+	if (sqlite3_exec(db_writer->handle, "pragma journal_mode=WAL;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		LogMe.wt("db: could not switch to WAL mode: %s", sqlite3_errmsg(db_writer->handle));
+	}
+	db_watcher = db_open_conn(SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX);
+	if (!db_watcher)
+	{
+		db_close();
+		return 0;
+	}
+	db_pool_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+	db_reload_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+	if (!db_pool_mutex || !db_reload_mutex)
+	{
+		LogMe.et("db: could not allocate the connection pool mutexes");
+		db_close();
+		return 0;
+	}
+	LogMe.it("db: %s opened", db_file_name);
+	// taken before the snapshot is built, a change committed in between triggers another reload
+	db_schedule_data_version = db_get_data_version();
+	if (db_schedule_data_version < 0 || !db_reload_schedule())
+	{
+		db_close();
+		return 0;
+	}
+	return 1;
 }
 
-// must be called from single thread environment!
+// closes every connection. must be called from single thread environment, after the last query!
 void db_close() {
-	if (db)
+	if (!db_writer)
+	{
+		return;
+	}
+	db_log_stmt_stats();
+	db_free_schedules();
+	while (db_readers)
+	{
+		DbConn* conn = db_readers;
+		db_readers = conn->next;
+		db_close_conn(conn);
+	}
+	db_free_readers = NULL;
+	db_reader_num = 0;
+	sqlite3_mutex_free(db_pool_mutex); db_pool_mutex = NULL;
+	sqlite3_mutex_free(db_reload_mutex); db_reload_mutex = NULL;
+	if (db_watcher)
+	{
+		db_close_conn(db_watcher); db_watcher = NULL;
+	}
+	db_schedule_data_version = -1;
+	// the writer closes last, so the WAL is checkpointed into the database file
+	db_close_conn(db_writer); db_writer = NULL;
+}
+
+// resets the statement and clears its bindings for the next run, records the timing and gives the connection back
+static void db_release_stmt(DbRun* run) {
+	DbStmt* ds = &run->conn->stmts[run->id];
+	long long run_us = 0;
+	if (ds->stmt)
+	{
+		sqlite3_reset(ds->stmt);
+		sqlite3_clear_bindings(ds->stmt);
+		run_us = db_now_us() - run->start_us;
+		ds->runs++;
+		ds->run_us += run_us;
+		if (run_us > ds->max_run_us)
+		{
+			ds->max_run_us = run_us;
+		}
+	}
+	if (run->conn == db_writer)
+	{
+		sqlite3_mutex_leave(sqlite3_db_mutex(db_writer->handle));
+	}
+	else if (run->conn != db_watcher)
+	{
+		db_release_reader(run->conn);
+	}
+	run->conn = NULL;
+	if (run_us > db_slow_run_us)
+	{
+		LogMe.wt("db statement %s: slow run took %lld us", db_stmt_infos[run->id].name, run_us);
+	}
+}
+
+// takes a connection for the statement and returns the statement ready for binding, preparing it on first use.
+// every non-NULL result must be given back with db_release_stmt(). returns NULL when the database is not open,
+// no connection is available or the statement could not be prepared.
+static sqlite3_stmt* db_acquire_stmt(DbStmtId id, DbRun* run) {
+	*run = (DbRun){ .id = id };
+	if (!db_writer)
+	{
+		LogMe.et("db statement %s: the database is not open", db_stmt_infos[id].name);
+		return NULL;
+	}
+	if (db_stmt_infos[id].writes)
+	{
+		run->conn = db_writer;
+		sqlite3_mutex_enter(sqlite3_db_mutex(db_writer->handle));
+	}
+	else if (db_stmt_infos[id].watches)
 	{
-		while (sqlite3_close(db) != SQLITE_OK);
-		db = NULL;
+		// only one thread uses the watcher connection
+		run->conn = db_watcher;
 	}
+	else
+	{
+		run->conn = db_acquire_reader();
+		if (!run->conn)
+		{
+			return NULL;
+		}
+	}
+	DbStmt* ds = &run->conn->stmts[id];
+	run->start_us = db_now_us();
+	if (!ds->stmt)
+	{
+		if (sqlite3_prepare_v3(run->conn->handle, db_stmt_infos[id].sql, -1, SQLITE_PREPARE_PERSISTENT, &ds->stmt, NULL) != SQLITE_OK)
+		{
+			LogMe.et("db statement %s: prepare failed: %s", db_stmt_infos[id].name, sqlite3_errmsg(run->conn->handle));
+			sqlite3_finalize(ds->stmt); ds->stmt = NULL;
+			run->start_us = 0;
+			db_release_stmt(run);
+			return NULL;
+		}
+		long long now_us = db_now_us();
+		ds->prepare_us = now_us - run->start_us;
+		run->start_us = now_us;
+	}
+	return ds->stmt;
 }
 
-void check_db() {
-	while (!db);
+// an exam of a seat in the schedule snapshot
+typedef struct SeatExam {
+	long long eid;
+	long long start_ts;
+	long long end_ts;
+	// index into ExamSchedule.papers, -1 when the seat has no paper for the exam
+	int paper;
+	// where the seat hands in, resdir.dir_path joined with sub_res_dir_name and ending with a backslash.
+	// NULL when the seat has no result directory for the exam
+	const char* res_dir;
+} SeatExam;
+
+typedef struct SchedulePaper {
+	long long pid;
+	const char* path;
+	const char* mime_type;
+	const char* dl_name;
+} SchedulePaper;
+
+// an in-memory snapshot of exam, paper, resdir and pos_exam, so lookups by seat do not touch sqlite.
+// a snapshot is never modified after it is published: request threads read it without any locking,
+// a reload publishes a new one and retires the old one, which is freed by a later reload or change check once db_schedule_grace_s has passed.
+typedef struct ExamSchedule {
+	// the exams of seat pos are seat_exams[seat_first[pos]] .. seat_exams[seat_first[pos + 1] - 1], sorted by start_ts
+	int pos_num;
+	const int* seat_first;
+	const SeatExam* seat_exams;
+	int paper_num;
+	const SchedulePaper* papers;
+	// when the snapshot was replaced by a newer one
+	long long retired_ts;
+	struct ExamSchedule* next_retired;
+	// the snapshot and everything it points to are allocated from this arena
+	varena arena;
+} ExamSchedule;
+
+static ExamSchedule* volatile db_schedule = NULL;
+// replaced snapshots that request threads may still be reading, guarded by db_reload_mutex
+static ExamSchedule* db_retired_schedules = NULL;
+
+// the current snapshot, NULL before the first successful db_reload_schedule()
+static const ExamSchedule* db_current_schedule() {
+#ifdef LOGME_WINDOWS
+	// volatile reads have acquire semantics with msvc
+	return db_schedule;
+#else
+	return __atomic_load_n(&db_schedule, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// makes next the current snapshot and returns the previous one
+static ExamSchedule* db_publish_schedule(ExamSchedule* next) {
+#ifdef LOGME_WINDOWS
+	return InterlockedExchangePointer((PVOID volatile*)&db_schedule, next);
+#else
+	return __atomic_exchange_n(&db_schedule, next, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// joins dir_path and sub_dir_name (which may be NULL or empty) into a directory path ending with a backslash,
+// allocated from arena. returns NULL when dir_path is NULL or empty, or out of memory.
+static const char* db_join_res_dir(varena arena, const char* dir_path, const char* sub_dir_name) {
+	size_t dir_len = dir_path ? strlen(dir_path) : 0;
+	while (dir_len > 0 && (dir_path[dir_len - 1] == '\\' || dir_path[dir_len - 1] == '/'))
+	{
+		dir_len--;
+	}
+	if (dir_len == 0)
+	{
+		return NULL;
+	}
+	size_t sub_len = sub_dir_name ? strlen(sub_dir_name) : 0;
+	char* res_dir = varena_alloc(arena, dir_len + 1 + sub_len + 2);
+	if (!res_dir)
+	{
+		return NULL;
+	}
+	memcpy(res_dir, dir_path, dir_len);
+	res_dir[dir_len] = '\\';
+	size_t len = dir_len + 1;
+	if (sub_len > 0)
+	{
+		memcpy(res_dir + len, sub_dir_name, sub_len);
+		len += sub_len;
+		res_dir[len++] = '\\';
+	}
+	res_dir[len] = '\0';
+	return res_dir;
+}
+
+// reads exam, paper, resdir and pos_exam into a new snapshot, returns NULL on failure
+static ExamSchedule* db_build_schedule() {
+	varena arena = make_varena(db_schedule_arena_block_size);
+	ExamSchedule* schedule = arena ? varena_alloc(arena, sizeof(ExamSchedule)) : NULL;
+	SeatExam* exams = NULL;
+	int* exam_pos = NULL;
+	SchedulePaper* papers = NULL;
+	int exam_num = 0, exam_cap = 0, paper_num = 0, paper_cap = 0;
+	DbRun run;
+	sqlite3_stmt* sql_statement = schedule ? db_acquire_stmt(STMT_GET_SCHEDULE, &run) : NULL;
+	if (!sql_statement)
+	{
+		delete_varena(arena, &arena);
+		return NULL;
+	}
+	int step_result;
+	while ((step_result = sqlite3_step(sql_statement)) == SQLITE_ROW)
+	{
+		long long pos = sqlite3_column_int64(sql_statement, 0);
+		if (pos > db_schedule_max_pos)
+		{
+			LogMe.wt("db: seat %lld is out of range and left out of the schedule", pos);
+			continue;
+		}
+		if (exam_num == exam_cap)
+		{
+			exam_cap = exam_cap ? exam_cap * 2 : 256;
+			SeatExam* new_exams = realloc(exams, exam_cap * sizeof(SeatExam));
+			int* new_exam_pos = realloc(exam_pos, exam_cap * sizeof(int));
+			exams = new_exams ? new_exams : exams;
+			exam_pos = new_exam_pos ? new_exam_pos : exam_pos;
+			if (!new_exams || !new_exam_pos)
+			{
+				step_result = SQLITE_NOMEM;
+				break;
+			}
+		}
+		SeatExam* se = &exams[exam_num];
+		*se = (SeatExam){
+			.eid = sqlite3_column_int64(sql_statement, 1),
+			.start_ts = sqlite3_column_int64(sql_statement, 2),
+			.end_ts = sqlite3_column_int64(sql_statement, 3),
+			.paper = -1
+		};
+		const char* dir_path = (const char*)sqlite3_column_text(sql_statement, 8);
+		if (dir_path && dir_path[0])
+		{
+			se->res_dir = db_join_res_dir(arena, dir_path, (const char*)sqlite3_column_text(sql_statement, 9));
+			if (!se->res_dir)
+			{
+				step_result = SQLITE_NOMEM;
+				break;
+			}
+		}
+		if (sqlite3_column_type(sql_statement, 4) != SQLITE_NULL)
+		{
+			long long pid = sqlite3_column_int64(sql_statement, 4);
+			// there are only a few papers, a linear search is fine
+			for (int i = 0; i < paper_num && se->paper < 0; i++)
+			{
+				se->paper = papers[i].pid == pid ? i : -1;
+			}
+			if (se->paper < 0)
+			{
+				if (paper_num == paper_cap)
+				{
+					paper_cap = paper_cap ? paper_cap * 2 : 16;
+					SchedulePaper* new_papers = realloc(papers, paper_cap * sizeof(SchedulePaper));
+					if (!new_papers)
+					{
+						step_result = SQLITE_NOMEM;
+						break;
+					}
+					papers = new_papers;
+				}
+				SchedulePaper* sp = &papers[paper_num];
+				*sp = (SchedulePaper){
+					.pid = pid,
+					.path = varena_substr(arena, sqlite3_column_text(sql_statement, 5), NULL),
+					.mime_type = varena_substr(arena, sqlite3_column_text(sql_statement, 6), NULL),
+					.dl_name = varena_substr(arena, sqlite3_column_text(sql_statement, 7), NULL)
+				};
+				if (!sp->path || !sp->mime_type || !sp->dl_name)
+				{
+					step_result = SQLITE_NOMEM;
+					break;
+				}
+				se->paper = paper_num++;
+			}
+		}
+		exam_pos[exam_num++] = (int)pos;
+	}
+	db_release_stmt(&run);
+	if (step_result == SQLITE_DONE)
+	{
+		// rows come sorted by pos and start_ts, so the exams of every seat are already in place
+		schedule->pos_num = exam_num > 0 ? exam_pos[exam_num - 1] + 1 : 0;
+		int* seat_first = varena_alloc(arena, (schedule->pos_num + 1) * sizeof(int));
+		SeatExam* seat_exams = varena_alloc(arena, (exam_num ? exam_num : 1) * sizeof(SeatExam));
+		SchedulePaper* schedule_papers = varena_alloc(arena, (paper_num ? paper_num : 1) * sizeof(SchedulePaper));
+		if (seat_first && seat_exams && schedule_papers)
+		{
+			for (int i = 0, pos = 0; pos <= schedule->pos_num; pos++)
+			{
+				while (i < exam_num && exam_pos[i] < pos)
+				{
+					i++;
+				}
+				seat_first[pos] = i;
+			}
+			memcpy(seat_exams, exams, exam_num * sizeof(SeatExam));
+			memcpy(schedule_papers, papers, paper_num * sizeof(SchedulePaper));
+			schedule->seat_first = seat_first;
+			schedule->seat_exams = seat_exams;
+			schedule->paper_num = paper_num;
+			schedule->papers = schedule_papers;
+			schedule->arena = arena;
+		}
+		else
+		{
+			step_result = SQLITE_NOMEM;
+		}
+	}
+	free(exams); free(exam_pos); free(papers);
+	if (step_result != SQLITE_DONE)
+	{
+		LogMe.et("db: could not build the schedule (sqlite error %d)", step_result);
+		delete_varena(arena, &arena);
+		return NULL;
+	}
+	return schedule;
+}
+
+static void delete_schedule(ExamSchedule* schedule) {
+	// the snapshot itself lives in its arena
+	varena arena = schedule->arena;
+	delete_varena(arena, &arena);
+}
+
+// frees the current and every retired snapshot. must be called from single thread environment!
+static void db_free_schedules() {
+	ExamSchedule* schedule = db_publish_schedule(NULL);
+	if (schedule)
+	{
+		delete_schedule(schedule);
+	}
+	while (db_retired_schedules)
+	{
+		schedule = db_retired_schedules;
+		db_retired_schedules = schedule->next_retired;
+		delete_schedule(schedule);
+	}
+}
+
+// frees the retired snapshots that were replaced at least db_schedule_grace_s before now_ts. the caller holds db_reload_mutex
+static void db_free_expired_schedules(long long now_ts) {
+	// a lookup holds a snapshot for nanoseconds, so a snapshot retired a grace period ago is no longer read
+	for (ExamSchedule** rp = &db_retired_schedules; *rp; )
+	{
+		ExamSchedule* retired = *rp;
+		if (now_ts - retired->retired_ts >= db_schedule_grace_s)
+		{
+			*rp = retired->next_retired;
+			delete_schedule(retired);
+		}
+		else
+		{
+			rp = &retired->next_retired;
+		}
+	}
+}
+
+// rebuilds the schedule snapshot from the database and publishes it, request threads see the new one at their next lookup.
+// returns 1 on success, 0 on failure, the current snapshot is kept then.
+int db_reload_schedule() {
+	long long start_us = db_now_us();
+	ExamSchedule* schedule = db_build_schedule();
+	if (!schedule)
+	{
+		return 0;
+	}
+	long long now_ts = time(NULL);
+	sqlite3_mutex_enter(db_reload_mutex);
+	ExamSchedule* previous = db_publish_schedule(schedule);
+	db_free_expired_schedules(now_ts);
+	if (previous)
+	{
+		previous->retired_ts = now_ts;
+		previous->next_retired = db_retired_schedules;
+		db_retired_schedules = previous;
+	}
+	sqlite3_mutex_leave(db_reload_mutex);
+	LogMe.it("db: schedule loaded with %d seats, %d seat exams and %d papers in %lld us"
+		, schedule->pos_num, schedule->pos_num ? schedule->seat_first[schedule->pos_num] : 0, schedule->paper_num, db_now_us() - start_us);
+	return 1;
+}
+
+// which exam of a seat db_find_seat_exam() looks for when none is running
+typedef enum SeatExamLookup {
+	// only the running exam
+	SEAT_EXAM_RUNNING = 0,
+	// the latest exam that has started, so hand-ins can still be resumed after the end
+	SEAT_EXAM_STARTED,
+	// the next exam, or else the last one
+	SEAT_EXAM_NEAREST
+} SeatExamLookup;
+
+// data_version of the watcher connection, -1 on failure
+static long long db_get_data_version() {
+	DbRun run;
+	sqlite3_stmt* sql_statement = db_acquire_stmt(STMT_GET_DATA_VERSION, &run);
+	if (!sql_statement)
+	{
+		return -1;
+	}
+	long long data_version = -1;
+	int step_result = sqlite3_step(sql_statement);
+	if (step_result == SQLITE_ROW)
+	{
+		data_version = sqlite3_column_int64(sql_statement, 0);
+	}
+	else
+	{
+		LogMe.et("db: could not read data_version (sqlite error %d)", step_result);
+	}
+	db_release_stmt(&run);
+	return data_version;
+}
+
+// rebuilds and publishes the schedule snapshot when the database has changed since the current one was built,
+// e.g. an exam time was edited with sqlite3.exe. cheap enough to be called every second: it only reads a counter.
+// returns 1 when a new snapshot was published, 0 when nothing changed, -1 on failure, the current snapshot is kept then
+// and the next call tries again. must only be called from one thread at a time!
+int db_reload_schedule_if_changed() {
+	long long data_version = db_get_data_version();
+	if (data_version < 0)
+	{
+		return -1;
+	}
+	if (data_version == db_schedule_data_version)
+	{
+		sqlite3_mutex_enter(db_reload_mutex);
+		db_free_expired_schedules(time(NULL));
+		sqlite3_mutex_leave(db_reload_mutex);
+		return 0;
+	}
+	LogMe.it("db: the database has changed, reloading the schedule");
+	if (!db_reload_schedule())
+	{
+		return -1;
+	}
+	db_schedule_data_version = data_version;
+	return 1;
+}
+
+// the exam of the seat that is running at now_ts, or else the one chosen by lookup, or NULL.
+// the seat is found by index and its exams with a binary search.
+static const SeatExam* db_find_seat_exam(const ExamSchedule* schedule, long long pos, long long now_ts, SeatExamLookup lookup) {
+	if (!schedule || pos < 0 || pos >= schedule->pos_num)
+	{
+		return NULL;
+	}
+	int lo = schedule->seat_first[pos], hi = schedule->seat_first[pos + 1];
+	if (lo == hi)
+	{
+		return NULL;
+	}
+	// the first exam that starts after now_ts
+	int first = lo, last = hi;
+	while (first < last)
+	{
+		int mid = first + (last - first) / 2;
+		if (schedule->seat_exams[mid].start_ts <= now_ts)
+		{
+			first = mid + 1;
+		}
+		else
+		{
+			last = mid;
+		}
+	}
+	if (first > lo && schedule->seat_exams[first - 1].end_ts >= now_ts)
+	{
+		return &schedule->seat_exams[first - 1];
+	}
+	switch (lookup)
+	{
+	case SEAT_EXAM_STARTED:
+		return first > lo ? &schedule->seat_exams[first - 1] : NULL;
+	case SEAT_EXAM_NEAREST:
+		return &schedule->seat_exams[first < hi ? first : hi - 1];
+	default:
+		return NULL;
+	}
+}
+
+// the exam of the seat from the schedule snapshot, without touching sqlite: the running one, or else the next one, or else the last one.
+// returns 1 and stores its start and duration, 0 when the seat has no exam.
+int db_get_exam_time(long long pos, long long now_ts, long long* start_ts, long long* duration_s) {
+	const SeatExam* se = db_find_seat_exam(db_current_schedule(), pos, now_ts, SEAT_EXAM_NEAREST);
+	if (!se)
+	{
+		return 0;
+	}
+	*start_ts = se->start_ts;
+	*duration_s = se->end_ts - se->start_ts;
+	return 1;
+}
+
+// the directory the seat hands in to, from the schedule snapshot without touching sqlite: the one of the running exam,
+// or else of the latest exam that has started. the path ends with a backslash and is allocated from arena,
+// or from the heap when arena is NULL. returns NULL when the seat has no such exam or the exam has no result directory.
+char* db_get_exam_dir(varena arena, long long pos, long long now_ts) {
+	const SeatExam* se = db_find_seat_exam(db_current_schedule(), pos, now_ts, SEAT_EXAM_STARTED);
+	if (!se || !se->res_dir)
+	{
+		return NULL;
+	}
+	// the snapshot may be freed after a reload, the path outlives it
+	return varena_substr(arena, se->res_dir, NULL);
 }
 
 void db_deletePaper(Paper* paper) {
-	if (!paper)
+	if (!paper || paper->arena)
 	{
 		return;
 	}
@@ -43,38 +806,127 @@ void db_deletePaper(Paper* paper) {
 	free(paper->dl_name); paper->dl_name = NULL;
 }
 
-Paper db_get_paper(long long pos) {
-	check_db();
-	Paper paper = { .valid = 0 };
-	sqlite3_stmt* sql_statement = NULL;
-	int prepared_code = sqlite3_prepare(db,
-		"select file_path, mime_type, name from"
-		"(select pe.pid as current_pid from (select pid, eid from pos_exam where pos=@pos)pe,(select * from exam)e where pe.eid=e.id and e.start_ts<=cast(strftime('%s', 'now') as INTEGER) and e.start_ts+e.duration_s>=cast(strftime('%s', 'now') as INTEGER)),"
-		"(select * from paper)"
-		"where current_pid=id;"
-		, -1, &sql_statement, NULL);
-	const char *prepared_err_msg =sqlite3_errmsg(db);
-	int pos_index = sqlite3_bind_parameter_index(sql_statement, "@pos");
-	int bind_code = sqlite3_bind_int(sql_statement, pos_index, pos);
-	const char* bind_err_msg = sqlite3_errmsg(db);
+// the paper of the exam that is running at the seat, from the schedule snapshot without touching sqlite.
+// strings of the returned paper are allocated from arena, or from the heap when arena is NULL
+Paper db_get_paper(varena arena, long long pos) {
+	Paper paper = { .valid = 0, .arena = arena };
+	const ExamSchedule* schedule = db_current_schedule();
+	const SeatExam* se = db_find_seat_exam(schedule, pos, time(NULL), SEAT_EXAM_RUNNING);
+	if (!se || se->paper < 0)
+	{
+		return paper;
+	}
+	const SchedulePaper* sp = &schedule->papers[se->paper];
+	// the snapshot may be freed after a reload, the paper outlives it
+	paper.path = varena_substr(arena, sp->path, NULL);
+	paper.mime_type = varena_substr(arena, sp->mime_type, NULL);
+	paper.dl_name = varena_substr(arena, sp->dl_name, NULL);
+	if (paper.path && paper.mime_type && paper.dl_name)
+	{
+		paper.valid = 1;
+	}
+	else
+	{
+		db_deletePaper(&paper);
+	}
+	return paper;
+}
+// a paper assigned to an exam that is running or starts before a given time
+typedef struct UpcomingPaper {
+	VLISTNODE
+	long long eid;
+	long long pid;
+	long long start_ts;
+	long long end_ts;
+	char* path;
+	char* mime_type;
+	char* dl_name;
+	// number of pos_exam rows (seats) that get this paper
+	int pos_num;
+} UpcomingPaper;
+
+static int clear_upcoming_paper(vlist this_vlist, long i, void* extra) {
+	UpcomingPaper* up = this_vlist->get(this_vlist, i);
+	free(up->path); up->path = NULL;
+	free(up->mime_type); up->mime_type = NULL;
+	free(up->dl_name); up->dl_name = NULL;
+	return 0; // go on
+}
+
+void db_delete_upcoming_papers(vlist papers, vlist* papers_ptr) {
+	if (papers)
+	{
+		papers->foreach(papers, clear_upcoming_paper, NULL);
+		delete_vlist(papers, papers_ptr);
+	}
+}
+
+// papers of the exams that are still running at now_ts or start no later than until_ts, one node per (exam, paper).
+// returns NULL on failure, free the result with db_delete_upcoming_papers().
+vlist db_get_upcoming_papers(long long now_ts, long long until_ts) {
+	vlist papers = make_vlist(sizeof(UpcomingPaper));
+	if (!papers)
+	{
+		return NULL;
+	}
+	DbRun run;
+	sqlite3_stmt* sql_statement = db_acquire_stmt(STMT_GET_UPCOMING_PAPERS, &run);
+	if (!sql_statement)
+	{
+		delete_vlist(papers, &papers);
+		return NULL;
+	}
+	sqlite3_bind_int64(sql_statement, sqlite3_bind_parameter_index(sql_statement, "@now"), now_ts);
+	sqlite3_bind_int64(sql_statement, sqlite3_bind_parameter_index(sql_statement, "@until"), until_ts);
 	int step_result;
-	if ((step_result = sqlite3_step(sql_statement)) == SQLITE_ROW)
+	while ((step_result = sqlite3_step(sql_statement)) == SQLITE_ROW)
 	{
-		const char* file_path = sqlite3_column_text(sql_statement, 0);
-		const char* mime_type = sqlite3_column_text(sql_statement, 1);
-		const char* dl_name = sqlite3_column_text(sql_statement, 2);
-		paper.path = zero_malloc(strlen(file_path) + 1);
-		paper.mime_type = zero_malloc(strlen(mime_type) + 1);
-		paper.dl_name = zero_malloc(strlen(dl_name) + 1);
-		if (paper.path && paper.mime_type && paper.dl_name)
+		UpcomingPaper up = {
+			.eid = sqlite3_column_int64(sql_statement, 0),
+			.pid = sqlite3_column_int64(sql_statement, 1),
+			.start_ts = sqlite3_column_int64(sql_statement, 2),
+			.end_ts = sqlite3_column_int64(sql_statement, 3),
+			.path = substr(sqlite3_column_text(sql_statement, 4), NULL),
+			.mime_type = substr(sqlite3_column_text(sql_statement, 5), NULL),
+			.dl_name = substr(sqlite3_column_text(sql_statement, 6), NULL),
+			.pos_num = sqlite3_column_int(sql_statement, 7)
+		};
+		if (!up.path || !up.mime_type || !up.dl_name || papers->add(papers, &up) != 0)
 		{
-			memcpy(paper.path, file_path, strlen(file_path));
-			memcpy(paper.mime_type, mime_type, strlen(mime_type));
-			memcpy(paper.dl_name, dl_name, strlen(dl_name));
-			paper.valid = 1;
+			free(up.path); free(up.mime_type); free(up.dl_name);
+			step_result = SQLITE_NOMEM;
+			break;
 		}
 	}
-	const char* step_err_msg = sqlite3_errmsg(db);
-	sqlite3_finalize(sql_statement);
-	return paper;
-}
\ No newline at end of file
+	db_release_stmt(&run);
+	if (step_result != SQLITE_DONE)
+	{
+		db_delete_upcoming_papers(papers, &papers);
+		return NULL;
+	}
+	return papers;
+}
+
+// the earliest deadline (start_ts+duration_s) of the exams that end at or after since_ts.
+// returns 1 and stores the deadline in end_ts, 0 when there is no such exam, -1 on failure.
+int db_get_next_exam_end(long long since_ts, long long* end_ts) {
+	DbRun run;
+	sqlite3_stmt* sql_statement = db_acquire_stmt(STMT_GET_NEXT_EXAM_END, &run);
+	if (!sql_statement)
+	{
+		return -1;
+	}
+	sqlite3_bind_int64(sql_statement, sqlite3_bind_parameter_index(sql_statement, "@since"), since_ts);
+	int found = -1;
+	if (sqlite3_step(sql_statement) == SQLITE_ROW)
+	{
+		// min() of no rows is NULL
+		found = sqlite3_column_type(sql_statement, 0) != SQLITE_NULL;
+		if (found)
+		{
+			*end_ts = sqlite3_column_int64(sql_statement, 0);
+		}
+	}
+	db_release_stmt(&run);
+	return found;
+}
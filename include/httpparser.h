@@ -110,6 +110,89 @@ void freeHttpMessage(HttpMessage* httpmsg);
 // 不要更改返回的结构体中的任何指针字段（可以修改指针指向的变量的值，但不能修改指针本身），否则会造成内存泄露。
 // 当返回的 HttpMessage 结构体不再被使用，请调用 freeHttpMessage() 来释放它，否则会造成内存泄漏。
 HttpMessage parse_http_message(const char* message, int is_response);
+
+// 流式 HTTP 解析器。每个连接持有一个，收到的数据块直接喂给它，报文头的每个字节只被扫描一次，回调函数直接填充 HttpMessage。
+typedef struct HttpStreamParser HttpStreamParser;
+// 创建一个流式 HTTP 解析器，失败时返回 NULL。不再使用时请调用 delete_http_stream_parser() 释放它。
+HttpStreamParser* new_http_stream_parser(int is_response);
+void delete_http_stream_parser(HttpStreamParser* sp, HttpStreamParser** sp_addr);
+// 把一块数据喂给解析器。解析器只取走属于当前报文头的数据，报文头之后的数据（body 或流水线中的下一个报文）不会被取走，
+// 被取走的字节数存放在 consumed_p 指向的变量中（consumed_p 可以是 NULL）。数据不合法时，这块数据会被全部取走并丢弃。
+// 返回值：
+// 0 : 报文头还不完整，需要更多数据
+// 1 : 报文头已结束（解析成功或失败），请调用 take_http_stream_message() 取出报文，在此之前解析器不再取走任何数据
+int feed_http_stream_parser(HttpStreamParser* sp, const char* data, size_t len, size_t* consumed_p);
+// 取出解析好的报文并让解析器准备解析下一个报文，只能在 feed_http_stream_parser() 返回 1 之后调用。
+// 返回的 HttpMessage 结构体的检查和释放方法与 parse_http_message() 的返回值相同。
+HttpMessage take_http_stream_message(HttpStreamParser* sp);
+
+// 指向报文中某一段数据的视图，不以空字符结尾。at 为 NULL 表示这段数据不存在
+typedef struct HttpSlice {
+	const char* at;
+	size_t len;
+} HttpSlice;
+typedef struct HttpSliceKV {
+	HttpSlice field;
+	HttpSlice value;
+} HttpSliceKV;
+#define HTTP_VIEW_MAX_QUERIES 32
+// query string 索引（开放寻址哈希表）的槽数，必须是 2 的幂并且大于 HTTP_VIEW_MAX_QUERIES
+#define HTTP_VIEW_QUERY_INDEX_SIZE 64
+#define HTTP_VIEW_MAX_FRAGMENTS 8
+#define HTTP_VIEW_MAX_HEADERS 64
+// HttpMessage 的零拷贝版本：所有字段都是指向调用者接收缓冲区的视图，解析过程不会动态分配内存。
+// 视图在下一次调用 feed_http_view_parser() 之前有效，调用者在此之前不能修改或移动报文头所在的数据。
+// error_name 和 error_reason 指向静态字符串，不需要释放。
+typedef struct HttpMessageView {
+	int success;
+	const char* error_name;
+	const char* error_reason;
+	HttpMethod method;
+	int http_major;
+	int http_minor;
+	HttpSlice url;
+	HttpSlice path;
+	int query_string_num;
+	HttpSliceKV query_string[HTTP_VIEW_MAX_QUERIES];
+	// 解析 URL 时建立的 query string 索引，存放 query_string 的下标 + 1，0 表示空槽。同名字段只索引最后一个
+	unsigned char query_index[HTTP_VIEW_QUERY_INDEX_SIZE];
+	int url_fragment_num;
+	HttpSliceKV url_fragment[HTTP_VIEW_MAX_FRAGMENTS];
+	int http_headers_num;
+	HttpSliceKV http_headers[HTTP_VIEW_MAX_HEADERS];
+	long long content_length;
+	long status_code;
+	HttpSlice location;
+} HttpMessageView;
+// 创建一个解析出 HttpMessageView 的流式 HTTP 解析器，失败时返回 NULL。不再使用时请调用 delete_http_stream_parser() 释放它。
+HttpStreamParser* new_http_view_parser(int is_response);
+// 与 feed_http_stream_parser() 类似，但 message 必须从当前报文的第一个字节开始，包含之前已经喂过的所有数据（内容不变，位置可以移动），
+// 解析器只解析新增的部分。报文头结束前解析器不取走任何数据（consumed_p 指向的变量为 0）；
+// 报文头结束时 consumed_p 指向的变量是报文头的长度；数据不合法时是 len，这些数据应被丢弃。
+// 返回值：
+// 0 : 报文头还不完整，需要更多数据
+// 1 : 报文头已结束（解析成功或失败），请调用 take_http_message_view() 取出报文
+int feed_http_view_parser(HttpStreamParser* sp, const char* message, size_t len, size_t* consumed_p);
+// 取出解析好的报文视图并让解析器准备解析下一个报文，只能在 feed_http_view_parser() 返回 1 之后调用。
+// 返回的指针指向解析器内部，在下一次调用 feed_http_view_parser() 之前有效，不需要释放。
+const HttpMessageView* take_http_message_view(HttpStreamParser* sp);
+// 在键值对数组中查找字段，返回最后一个匹配的字段的值，找不到时返回的 HttpSlice 的 at 为 NULL
+HttpSlice find_http_slice_kv(const HttpSliceKV* kvs, int num, const char* field);
+// 查找报文头字段，字段名不区分大小写。返回最后一个匹配的字段的值，找不到时返回的 HttpSlice 的 at 为 NULL
+HttpSlice http_view_header(const HttpMessageView* view, const char* field);
+// 通过索引查找 query string 中的字段，耗时与字段的数量无关。返回最后一个同名字段的值，找不到时返回的 HttpSlice 的 at 为 NULL
+HttpSlice http_view_query(const HttpMessageView* view, const char* field);
+// 查找 query string 中的字段并把它的值解析为十进制整数，成功返回 1，字段不存在、不是整数或超出范围返回 0
+int http_view_query_int(const HttpMessageView* view, const char* field, int* value_p);
+int http_view_query_ll(const HttpMessageView* view, const char* field, long long* value_p);
+// 比较视图与字符串是否完全相同
+int http_slice_equal(HttpSlice slice, const char* str);
+// 比较视图与字符串是否相同，不区分大小写（例如比较报文头字段的值）
+int http_slice_case_equal(HttpSlice slice, const char* str);
+// 把整个视图解析为十进制整数，成功返回 1，视图不存在、不是整数或溢出返回 0
+int http_slice_to_ll(HttpSlice slice, long long* value_p);
+// 把视图复制到 buf 中并在结尾添加空字符，成功返回 1，视图不存在或 buf 放不下返回 0
+int http_slice_copy(HttpSlice slice, char* buf, size_t buf_len);
 #endif // CASE_INSENSITIVE_STRCMP
 
 #ifdef __cplusplus
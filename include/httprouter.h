@@ -0,0 +1,40 @@
+#ifndef HTTPROUTER
+#define HTTPROUTER
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "httpparser.h"
+
+// 编译好的路由表：以路径为键的基数树（radix tree）。查找时只沿着路径走一遍，耗时与路径长度有关，与路由的数量无关。
+// 路由表构建完成后是只读的，可以被多个线程同时查找。
+typedef struct HttpRouter HttpRouter;
+
+typedef enum HttpRouteType {
+	// 路径必须完全相同
+	HTTP_ROUTE_EXACT = 0,
+	// 路径以此字符串开头（与 HttpHandler 的 path_contains 含义相同）
+	HTTP_ROUTE_PREFIX
+} HttpRouteType;
+
+// 创建一个空的路由表，失败时返回 NULL。不再使用时请调用 delete_http_router() 释放它。
+HttpRouter* new_http_router();
+void delete_http_router(HttpRouter* router, HttpRouter** router_addr);
+// 添加一条路由。method 为 INVALID_METHOD 表示匹配任何方法。同一路径、类型和方法重复添加时，后添加的覆盖先添加的。
+// 返回值：
+// 0 : 成功
+// -1 : 参数不合法（path 或 value 是 NULL，或 path 是空字符串）
+// -2 : 动态内存分配失败
+int http_router_add(HttpRouter* router, const char* path, HttpRouteType type, HttpMethod method, void* value);
+// 查找路径对应的路由，找不到返回 NULL。
+// 完全相同的路由优先于前缀路由；前缀路由之间，最长的前缀优先；同一条路径上，指定了方法的路由优先于匹配任何方法的路由。
+void* http_router_match(const HttpRouter* router, const char* path, size_t path_len, HttpMethod method);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !HTTPROUTER
@@ -7,6 +7,7 @@ extern "C" {
 
 #include "httpparser.h"
 #include "vlist.h"
+#include "vutils.h"
 
 #define MIME_TYPE_HTML "text/html"
 #define MIME_TYPE_BIN "application/octet-stream"
@@ -16,12 +17,17 @@ extern "C" {
 
 #define HTTP_CHARSET_UTF8 "utf-8"
 
+// ϴļ SHA-25664 λʮͻ˿ṩԱУ飬receive_file() ڻظз
+#define HTTP_HEADER_CONTENT_SHA256 "X-Content-SHA256"
+
 typedef struct tcp_node tcp_node;
 typedef struct file_handle file_handle;
 
 typedef struct HttpHandlerPac {
 	void* extra;
 	tcp_node* node;
+	// 󼶱ڴأʱڴԴ䣬ҪͷţһԻ
+	varena arena;
 } HttpHandlerPac;
 
 // return value:
@@ -29,14 +35,37 @@ typedef struct HttpHandlerPac {
 // >0 && != INT_MAX : no shutdown
 // ==0 : recv 0 shutdown
 // <0 : error shutdown, in this case, the return value can be used as error code
-typedef int HTTP_HANDLE_FUNC_TYPE(HttpMessage* hmsg, HttpHandlerPac* pac);
+// hmsg ֶζָӽջͼֻڴ֮ǰЧ
+// ͨ recv_t() receive_file()ȡ bodyԲȡ body ֱӻظܾ󣩣ᶪûжȡ body
+// ͻ˴ Expect: 100-continue ʱûжȡ body ᱻ
+typedef int HTTP_HANDLE_FUNC_TYPE(const HttpMessageView* hmsg, HttpHandlerPac* pac);
+
+// ĵֻڽֹģʽ£ tcp_server_set_deadline_mode()ãƽʱһͬ
+typedef enum HttpPriorityClass {
+	HTTP_PRIORITY_NORMAL = 0,
+	// ƳٵСѯʹ̵߳ȼ
+	HTTP_PRIORITY_LOW,
+	// ƳٵĴأʹ̵߳ȼͬʱ͹ķ
+	HTTP_PRIORITY_BULK,
+	// 밴ʱɵύߴ̵߳ȼӲ
+	HTTP_PRIORITY_URGENT
+} HttpPriorityClass;
 
 // please notice that: URLs are case-sensitive.
+// ʱе HttpHandler һ·ɱÿֻһ·ɱʱ봦޹ء
 typedef struct HttpHandler {
 	VLISTNODE
+	// ǰ׺·ɣ·Դַͷжǰ׺·ƥʱ
 	const char* path_contains;
 	HTTP_HANDLE_FUNC_TYPE* handle_func;
 	void* extra;
+	// ȫƥ·ɣ·ַȫͬǰ׺·ɡ path_contains ͬʱ
+	const char* path_exact;
+	// ʱֻ method ָ HTTP з
+	int method_only;
+	HttpMethod method;
+	// ·ϵĵĬΪ HTTP_PRIORITY_NORMAL
+	HttpPriorityClass priority_class;
 } HttpHandler;
 
 void tcp_server_run(int port, int memmory_lack, vlist http_handlers
@@ -48,7 +77,15 @@ void tcp_server_run(int port, int memmory_lack, vlist http_handlers
 , const char* html_500
 );
 
+// 루on 㣩˳ֹģʽֹģʽڱ밴ʱɵ󼴽ڵʱ翼ԼύҪڽǰ꣩
+// HTTP_PRIORITY_URGENT Ĵ߳ȼHTTP_PRIORITY_LOW  HTTP_PRIORITY_BULK Ĵ߳̽ȼ
+// ͬʱദ bulk_slots  HTTP_PRIORITY_BULK 󣬶ȴλ˳ֹģʽʱٵȴ
+//  HTTP_PRIORITY_BULK ķ֮Ͳ bulk_bytes_per_s ֽÿ루0 ʾ٣
+// ߳ʱãڴһշʱµõȡ
+void tcp_server_set_deadline_mode(int on, int bulk_slots, unsigned long long bulk_bytes_per_s);
+
 // ˺Ὣ node ṹе socket ΪģʽöȡʱʱΪ node ṹеӦֶΣȻ recv()  recv() ķֵ
+//  Expect: 100-continue ʱһεô˺Ȼظ 100 Continueͻյŷ body
 // ˺־걸
 int recv_t(tcp_node* np, char* buf, int len, int flags);
 
@@ -86,23 +123,71 @@ int send_file(tcp_node* np, const char* filename, int keep_alive, const char* MI
 , const char *html_500
 );
 
+//  send_file() ͬļݴڴеļ淢ͣ
+// 水ļ·δʱļڴ棬ʱٴļѯļСӦͷļһεзͣ
+// ܴСޣʹõ˳̭ļڴϱ޸ģ޸ʱС仯󣬻ڶʱʧЧ¼ء
+// ļڡȡʧʱ˻ص send_file()
+// ֵ send_file() ͬ
+// ˺־걸ġ
+int send_cached_file(tcp_node* np, const char* filename, int keep_alive, const char* MIME_type, const char* file_charset, int is_download, const char* download_filename
+, const char *phrase_200
+, const char *html_200
+, const char *phrase_404
+, const char *html_404
+, const char *phrase_500
+, const char *html_500
+);
+
+// ļԤȼص send_cached_file() ʹõļУѻֻǷڣֱ֮Ӵڴ淢͡
+// size_p Ϊ NULL ʱͨļС
+// ֵ
+// 0 : ļڻ
+// -1 : ļ޷棨ڡȡʧܣ鿴־ԻȡϸϢ
+int preload_cached_file(const char* filename, unsigned long long* size_p);
+
 // ˺ recv_t() ݲתָıļУ
 // 󣬴ӡ־ظ 500 ҳ棻
 // δתݵļϺظ 200 ҳ档
+// ȰļĴСԤռд filename.part ʱļȫϺԭӵظΪ filenameѴ滻
+// ˽յһļļ֡дʧʱɾʱļжʱʱļͻ˿
+//  send_received_file_offset() ѯѾյֽ N file_offset = N ļʣĲ֡
+// file_size  body ĴСļ file_offset ʼʣಿֵĴСfile_offset Ϊ 0 ʱͷգ
+//  0 ʱʱļб file_offset ֽڵݣ file_offset Ĳֱ
+// ʱļڴϣȻ
+// յͬʱļ SHA-256ʱȶ֮ǰյĲ֣Ҫºٶһļ
+// expected_sha256 Ϊ NULL ʱ64 λʮִСдȽϣһɾʱļ
+// һ»ҪȽʱSHA-256  sha256sum ĸʽ filename.sha256 У 200 ظ X-Content-SHA256 ֶзء
 // ʧܣ鿴־ԻȡϸϢ
 // keep_alive ɻظֶΣʵʶϿҪֶС
 // ֵڵ 0 ʾûӴС 0 ʾӴ
 // 0 : תɹ
 // 1 : ظ 500 ɹ
+// 2 : ʱļе file_offsetظ 409 ɹͷ Upload-Offset ֶʵյֽbody ûбȡӦر
+// 3 : SHA-256  expected_sha256 һ£ظ 400 ɹͷ X-Content-SHA256 ֶյݵ SHA-256
 // -1 : ظʱʧܣӦٽи socket ӦϿ
 // ˺־걸ġ
-int receive_file(tcp_node* np, const char* file_dir, const char* filename, int keep_alive, long long file_size
+int receive_file(tcp_node* np, const char* file_dir, const char* filename, int keep_alive, long long file_size, long long file_offset, const char* expected_sha256
 , const char* phrase_200
 , const char* html_200
 , const char* phrase_500
 , const char* html_500
 );
 
+// ˺ظ receive_file() ΪָļѾյֽ
+// ûнϵʱļʱظ 200ͷ Upload-Offset ֶѾյֽ
+// ظ 404ûпݣӦͷϴֻظû bodyֱ HEAD 
+// ļڱһӽʱظǴ˿Ѿдֽ
+// keep_alive ɻظֶΣʵʶϿҪֶС
+// ֵ
+// 0 : ظ 200 ɹ
+// 1 : ظ 404 ɹ
+// -1 : ظʧܣӦٽи socket ӦϿ
+// ˺־걸ġ
+int send_received_file_offset(tcp_node* np, const char* file_dir, const char* filename, int keep_alive
+, const char* phrase_200
+, const char* phrase_404
+);
+
 #ifdef __cplusplus
 }
 #endif
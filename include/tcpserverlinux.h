@@ -12,6 +12,7 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "vlist.h"
 
@@ -20,6 +21,21 @@ typedef volatile struct TCPServerProperty * volatile TCPServerProperty;
 
 typedef volatile struct _______________TCPServer_______________ * volatile TCPServer;
 
+typedef enum {
+    TCPServerBackend_EPOLL,
+    /**
+     * multishot accept/recv into provided buffer rings, small writes through registered buffers. needs Linux 6.0 or later.
+     */
+    TCPServerBackend_IO_URING,
+} TCPServerBackend;
+
+typedef struct {
+    int shard_num;
+    int alive_clients_num;
+    unsigned long long accepted_clients_num;
+    unsigned long long closed_clients_num;
+} TCPServerStats;
+
 typedef enum {
     RFBServerState_VERSION_AWAIT,
     RFBServerState_SECURITY_TYPE_AWAIT,
@@ -47,16 +63,65 @@ volatile struct _______________TCPServer_______________ {
     } status;
     vlist client_list;
     int alive_clients_num;
+    /**
+     * NULL for a single event loop. for a sharded server, every shard is a TCPServer with its own listening socket,
+     * client_list and alive_clients_num, the sharded server itself holds no client.
+     */
+    vlist shards;
+    int shard_index;
+    /**
+     * the backend actually in use, it falls back to TCPServerBackend_EPOLL if the requested one is not supported.
+     */
+    TCPServerBackend backend;
 
+    /**
+     * register the callback of a client state. the callback of the client's current state is called once right after
+     * the client is accepted (so the server can speak first), then every time the client becomes readable.
+     * @note the event loop is edge-triggered, the callback SHOULD keep calling tcp_read() until FailType_READ_EAGAIN occurs,
+     * otherwise it will not be called again until more data arrives. returning anything other than Action_NO_ACTION closes the client.
+     */
     void (*AddCallback)(TCPServer,RFBServerState,Action(*)(TCPClient));
+    /**
+     * run the event loop on the calling thread, blocks until Stop() is called or a fatal error occurs.
+     * @return true if the loop was stopped by Stop(), false on error.
+     */
     bool (*Run)(TCPServer);
+    /**
+     * ask a running event loop to return, can be called from any thread.
+     */
+    void (*Stop)(TCPServer);
+    /**
+     * close all the clients and free the server, MUST NOT be called while Run() is running.
+     */
     void (*Destroy)(TCPServer,TCPServer*);
+    /**
+     * sum up the counters of all the shards (or of this server if it is not sharded), can be called from any thread.
+     */
+    void (*GetStats)(TCPServer,TCPServerStats*);
 
     void (*DeleteProperty)(TCPServerProperty);
 };
 void new_server_property(TCPServer);
 
+/**
+ * create a server listening on {@param port} (IPv4/IPv6 dual stack), served by an epoll event loop.
+ * @param memoryLack use smaller event batches and clean up closed clients more often.
+ * @param runImmediately call Run() before returning, in this case the return value is the return value of Run().
+ * @return false if the listening socket or the event loop could not be created, *tcpServer is set to NULL in this case.
+ */
 bool new_tcp_server(TCPServer *tcpServer, int port, bool memoryLack, bool runImmediately);
+/**
+ * same as new_tcp_server(), but with {@param shardNum} event loops. every loop has its own SO_REUSEPORT listening socket,
+ * so the kernel spreads new connections among them, and Run() pins every loop to its own CPU.
+ * AddCallback(), Run(), Stop() and Destroy() of the returned server apply to all the shards.
+ * @param shardNum <= 0 means one shard per available CPU.
+ */
+bool new_tcp_server_sharded(TCPServer *tcpServer, int port, bool memoryLack, bool runImmediately, int shardNum);
+/**
+ * same as new_tcp_server_sharded(), with the I/O backend of every event loop chosen by {@param backend}.
+ * @param shardNum 1 creates a plain (not sharded) server.
+ */
+bool new_tcp_server_with_backend(TCPServer *tcpServer, int port, bool memoryLack, bool runImmediately, int shardNum, TCPServerBackend backend);
 
 typedef volatile struct _______________________TCPClientData_______________________ * volatile TCPClientData;
 typedef volatile struct TCPClientProperty * volatile TCPClientProperty;
@@ -94,11 +159,96 @@ typedef volatile struct {
 ReadWriteRes tcp_read(TCPClient client, void *buff, size_t buffLen);
 /**
  * set the client to nonblocking mode, then write some data to client, FailType_WRITE_EAGAIN may occurs.
+ * with TCPServerBackend_IO_URING the data is always queued and sent by the event loop, so FailType_WRITE_EAGAIN is the usual result.
  * @param success when writing is done, this flag will be set to true. This flag MUST be ACCESSIBLE until the writing is done.
  * @param fail if error occurs when writing, this flag will be set to true. This flag MUST be ACCESSIBLE until the writing is done.
  * @note the {@param buff} MUST be on the heap, when writing is done or error occurs, free() will be automatically called on it.
  */
 ReadWriteRes tcp_write(TCPClient client, void *buff, size_t buffLen, bool *success, bool *fail);
+/**
+ * same as tcp_write(), but the data is [{@param offset}, {@param offset} + {@param len}) of the file {@param fileFd}, sent with sendfile()
+ * so it never passes through user space. the rest is sent by the event loop when the socket is full.
+ * with TCPServerBackend_IO_URING the range is read into a heap buffer and written as usual.
+ * @note the {@param fileFd} is owned by the write, it is closed automatically when writing is done or error occurs.
+ */
+ReadWriteRes tcp_write_file(TCPClient client, int fileFd, off_t offset, size_t len, bool *success, bool *fail);
+/**
+ * same as tcp_write(), but {@param buff} is owned by the caller (for example a file cache) and sent with MSG_ZEROCOPY
+ * when it is large enough, so the kernel reads the pages directly instead of copying them.
+ * @param release called with {@param releaseArg} once the kernel no longer needs {@param buff} (or the write fails),
+ * {@param buff} MUST stay unchanged until then. it is called from the event loop thread.
+ */
+ReadWriteRes tcp_write_zerocopy(TCPClient client, const void *buff, size_t buffLen, void (*release)(void *), void *releaseArg, bool *success, bool *fail);
+
+/**
+ * reply a text response, same as send_text() of the windows server: the status line, the headers and the body are sent in one send().
+ * @param keepAlive only used for the Connection header, return an Action from the callback to really close the client.
+ * @return 0 if the response is sent or queued, non-zero if the client is broken and should be closed with Action_ERROR_SHUTDOWN.
+ */
+int tcp_send_text(TCPClient client, int statusCode, const char *reasonPhrase, bool keepAlive, const char *textBody, const char *MIMEType, const char *charset, bool isDownload, const char *downloadFilename);
+/**
+ * reply a file, same contract as send_file() of the windows server: the file is sent with tcp_write_file(), its header shares
+ * packets with the first file bytes. if the file can not be opened a 404 page is replied, if its size can not be got a 500 page.
+ * @return 0 file sent or queued, 1 404 replied, 2 500 replied, -1 the client is broken and should be closed with Action_ERROR_SHUTDOWN.
+ */
+int tcp_send_file(TCPClient client, const char *filename, bool keepAlive, const char *MIMEType, const char *fileCharset, bool isDownload, const char *downloadFilename
+        , const char *phrase200
+        , const char *html200
+        , const char *phrase404
+        , const char *html404
+        , const char *phrase500
+        , const char *html500
+);
+/**
+ * receive the request body into a file, same contract as receive_file() of the windows server, but asynchronous: the body is
+ * moved from the socket into the file with splice() through a pipe (with TCPServerBackend_IO_URING, or when splice() is not
+ * supported, it is copied through a buffer shared by the event loop). whatever is already readable is received before returning,
+ * the rest is received by the event loop, and the callbacks of the client are not called again until the whole body is in the file.
+ * the file is preallocated and written as <file>.part, it is renamed to its final name only when complete, so a partial upload
+ * never appears under the final name. if the file can not be written the part file is removed, if the client drops it is kept,
+ * also across restarts, and the upload can be resumed: tcp_send_received_file_offset() tells how many bytes N have been
+ * received, and the rest of the file is then sent with {@param fileOffset} = N.
+ * the SHA-256 of the whole file is computed while it is received (a copy of the spliced data is made with tee()), only a resumed
+ * upload reads back what was received before. it is saved as <file>.sha256 in the format of sha256sum before the file is renamed,
+ * and replied in the X-Content-SHA256 header of the 200.
+ * 200 is replied when the file is complete. if the file can not be written after receiving has started, 500 is replied and the
+ * client is closed after it.
+ * @param fileDir MUST end with '/', {@param filename} MUST NOT start with '/', neither may contain a relative path.
+ * @param fileSize the size of the request body, the part of the file from {@param fileOffset} on.
+ * @param fileOffset 0 to receive the whole file. otherwise the part file must hold at least as many bytes, those after it are
+ * dropped and received again.
+ * @param expectedSHA256 the digest the client sent (64 hex digits, any case), NULL if none. if the file does not match it, the part
+ * file is removed and 400 is replied with the X-Content-SHA256 header of what was received.
+ * @param received the bytes of the body the caller has already read from the client, written to the file first.
+ * @note the phrase and html strings MUST stay accessible until the reply is sent, string literals are fine.
+ * @return 0 receiving started (or completed), 1 500 replied because the file could not be opened, 2 409 replied because the part
+ * file holds less than {@param fileOffset} bytes, its Upload-Offset header tells how many: the body is left unread, so the client
+ * should be closed with Action_PROACTIVE_SHUTDOWN. -1 the client is broken and should be closed with Action_ERROR_SHUTDOWN.
+ */
+int tcp_receive_file(TCPClient client, const char *fileDir, const char *filename, bool keepAlive, long long fileSize, long long fileOffset, const char *expectedSHA256, const void *received, size_t receivedLen
+        , const char *phrase200
+        , const char *html200
+        , const char *phrase500
+        , const char *html500
+);
+/**
+ * reply how many bytes of a file tcp_receive_file() has received, for the client to resume the upload from: 200 with an
+ * Upload-Offset header if a part file exists, otherwise 404 (nothing to resume, upload from the start). neither reply has a
+ * body, so both fit a HEAD request.
+ * @return 0 200 replied, 1 404 replied, -1 the client is broken and should be closed with Action_ERROR_SHUTDOWN.
+ */
+int tcp_send_received_file_offset(TCPClient client, const char *fileDir, const char *filename, bool keepAlive
+        , const char *phrase200
+        , const char *phrase404
+);
+/**
+ * reply a file already held in memory (for example by a paper cache), the body is sent with tcp_write_zerocopy().
+ * @param release called with {@param releaseArg} once {@param fileData} is no longer needed, even if this call fails.
+ * @return 0 file sent or queued, -1 the client is broken and should be closed with Action_ERROR_SHUTDOWN.
+ */
+int tcp_send_cached_file(TCPClient client, const void *fileData, size_t fileSize, void (*release)(void *), void *releaseArg, bool keepAlive, const char *MIMEType, const char *fileCharset, bool isDownload, const char *downloadFilename
+        , const char *phrase200
+);
 
 #ifdef __cplusplus
 }
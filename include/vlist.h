@@ -55,6 +55,9 @@ volatile struct vlist_struct
 };
 
 vlist make_vlist(size_t node_size);
+// initialize a vlist inside caller-provided memory (at least sizeof(struct vlist_struct) bytes), returns NULL if vlist_mem is NULL.
+// such a vlist must not be passed to delete_vlist(), the caller owns the memory.
+vlist init_vlist(void* vlist_mem, size_t node_size);
 void delete_vlist(vlist vlist_, vlist* vlist_ptr);
 
 // modify nodes through the pointers returned from get() may be very dangerous. DO NOT modify the internal fields! use copyXX() functions instead of raw "=".
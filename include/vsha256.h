@@ -0,0 +1,42 @@
+#ifndef VSHA256
+#define VSHA256
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VSHA256_DIGEST_SIZE 32
+// 64 hex digits and the terminating null
+#define VSHA256_HEX_SIZE 65
+
+// incremental SHA-256, feed the data in any number of pieces. lives on the stack, nothing to free
+typedef struct vsha256 {
+	uint32_t state[8];
+	uint64_t total_len;
+	unsigned char block[64];
+	size_t block_len;
+} vsha256;
+
+void vsha256_init(vsha256* ctx);
+void vsha256_update(vsha256* ctx, const void* data, size_t len);
+/**
+ * finish the hash, {@param ctx} must be initialized again before it is reused.
+ */
+void vsha256_final(vsha256* ctx, unsigned char digest[VSHA256_DIGEST_SIZE]);
+/**
+ * write {@param digest} as 64 lowercase hex digits and a terminating null.
+ */
+void vsha256_hex(const unsigned char digest[VSHA256_DIGEST_SIZE], char hex[VSHA256_HEX_SIZE]);
+/**
+ * @return non-zero if {@param hex} (not necessarily null terminated) is the hex form of {@param digest}, case insensitive.
+ */
+int vsha256_hex_equal(const unsigned char digest[VSHA256_DIGEST_SIZE], const char* hex, size_t hex_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VSHA256
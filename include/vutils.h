@@ -50,6 +50,23 @@ string_list splitf(const char* str, const char* str_end, char delimiter, int fir
 string_list splitt(const char* str, const char* str_end, char delimiter, int total_n);
 void delete_string_list(string_list list, string_list* list_addr);
 
+// arena allocator: memory is handed out from large blocks and released all at once by varena_reset() or delete_varena().
+// an arena is not thread-safe, use one arena per thread (e.g. one per connection, reset after every request).
+typedef struct varena_struct* varena;
+// block_size: size of the first block, it is kept across varena_reset() so that small workloads never call malloc() again
+varena make_varena(size_t block_size);
+void delete_varena(varena arena, varena* arena_addr);
+// returns zeroed memory aligned for any fundamental type, or NULL when malloc() fails
+void* varena_alloc(varena arena, size_t n);
+// release everything allocated from the arena, only the first block is kept
+void varena_reset(varena arena);
+// same as substr(), but the result is allocated from the arena (from the heap when arena is NULL)
+char* varena_substr(varena arena, const char* substr_start, const char* substr_end);
+// same as splitf() / splitt(), but the list and all strings are allocated from the arena (from the heap when arena is NULL).
+// a list allocated from an arena must not be passed to delete_string_list(), and nodes must not be removed from it.
+string_list varena_splitf(varena arena, const char* str, const char* str_end, char delimiter, int first_n);
+string_list varena_splitt(varena arena, const char* str, const char* str_end, char delimiter, int total_n);
+
 // the time_zone value: e.g.:
 // GMT+8 -> time_zone = +8
 // GMT-8 -> time_zone = -8
@@ -39,6 +39,7 @@ extern "C" {
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "vutils.h"
 #include "vlist.h"
@@ -774,6 +775,20 @@ static int on_header_value(llhttp_t* parser, const char* at, size_t length) {
 	}
 	return 0;
 }
+static void set_parse_error(HttpMessage* httpmsg, const char* error_name, const char* error_reason) {
+	httpmsg->success = 0;
+	error_reason = error_reason ? error_reason : "";
+	httpmsg->error_name = zero_malloc(strlen(error_name) + 1);
+	httpmsg->error_reason = zero_malloc(strlen(error_reason) + 1);
+	if (!(httpmsg->error_name) || !(httpmsg->error_reason))
+	{
+		// malloc fail
+		httpmsg->malloc_success = 0;
+		return;
+	}
+	memcpy(httpmsg->error_name, error_name, strlen(error_name));
+	memcpy(httpmsg->error_reason, error_reason, strlen(error_reason));
+}
 HttpMessage parse_http_message(const char* message, int is_response) {
 	llhttp_t parser;
 	llhttp_settings_t settings;
@@ -803,22 +818,601 @@ HttpMessage parse_http_message(const char* message, int is_response) {
 	}
 	else {
 		// fail
-		httpmsg.success = 0;
-		const char* error_name = llhttp_errno_name(err);
-		const char* error_reason = parser.reason;
-		httpmsg.error_name = zero_malloc(strlen(error_name) + 1);
-		httpmsg.error_reason = zero_malloc(strlen(error_reason) + 1);
-		if (!(httpmsg.error_name) || !(httpmsg.error_reason))
+		set_parse_error(&httpmsg, llhttp_errno_name(err), parser.reason);
+	}
+	return httpmsg;
+}
+
+struct HttpStreamParser {
+	llhttp_t parser; // 必须是第一个成员，回调函数通过 llhttp_t 指针找到所在的 HttpStreamParser
+	llhttp_settings_t settings;
+	HttpMessage message;
+	int done;
+	size_t fed_len;
+	// llhttp 忽略 on_*_complete 回调的返回值，回调中发生的错误记录在这里，到报文头结束时再报告
+	const char* cb_error_reason;
+	// 正在拼接的 URL、header field 或 header value。
+	// 片段在同一次 feed 中就结束时，span_at 直接指向调用者的数据，不复制；片段跨越多次 feed 时才复制到 span_buf 中
+	const char* span_at;
+	size_t span_len;
+	int span_owned;
+	char* span_buf;
+	size_t span_buf_cap;
+	// 零拷贝模式：片段直接指向 view_base 开始的报文，view_base 移动时所有视图一起移动
+	HttpMessageView view;
+	const char* view_base;
+};
+
+// 确保片段已复制到 span_buf 中，并且 span_buf 还能再容纳 extra 个字节和结尾的空字符
+static int stream_span_own(HttpStreamParser* sp, size_t extra) {
+	size_t need = sp->span_len + extra + 1;
+	if (need > sp->span_buf_cap)
+	{
+		size_t cap = vmax(need, sp->span_buf_cap * 2);
+		char* buf = realloc(sp->span_buf, cap);
+		if (!buf)
 		{
-			// malloc fail
-			httpmsg.malloc_success = 0;
-			return httpmsg;
+			return 0;
+		}
+		sp->span_buf = buf; sp->span_buf_cap = cap;
+	}
+	if (!(sp->span_owned))
+	{
+		if (sp->span_len > 0)
+		{
+			memmove(sp->span_buf, sp->span_at, sp->span_len);
 		}
-		memcpy(httpmsg.error_name, error_name, strlen(error_name));
-		memcpy(httpmsg.error_reason, error_reason, strlen(error_reason));
+		sp->span_owned = 1;
+	}
+	sp->span_at = sp->span_buf;
+	return 1;
+}
+static void stream_span_clear(HttpStreamParser* sp) {
+	sp->span_at = NULL;
+	sp->span_len = 0;
+	sp->span_owned = 0;
+}
+static int stream_span_cb(llhttp_t* parser, const char* at, size_t length) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	if (sp->span_len == 0 && !(sp->span_owned))
+	{
+		sp->span_at = at; sp->span_len = length;
+		return 0;
 	}
+	if (!stream_span_own(sp, length))
+	{
+		sp->message.malloc_success = 0;
+		return -1;
+	}
+	memcpy(sp->span_buf + sp->span_len, at, length);
+	sp->span_len += length;
+	return 0;
+}
+// 记录回调中发生的第一个错误
+static int record_cb_error(HttpStreamParser* sp, const char* reason) {
+	if (!(sp->cb_error_reason))
+	{
+		sp->cb_error_reason = reason ? reason : "Callback error";
+	}
+	return -1;
+}
+static int stream_cb_result(HttpStreamParser* sp, int res) {
+	if (res)
+	{
+		return record_cb_error(sp, sp->message.malloc_success ? sp->parser.reason : "Malloc failed");
+	}
+	return 0;
+}
+static int stream_url_complete_cb(llhttp_t* parser) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	int res = url_cb(parser, sp->span_at ? sp->span_at : "", sp->span_len);
+	stream_span_clear(sp);
+	return stream_cb_result(sp, res);
+}
+static int stream_header_field_complete_cb(llhttp_t* parser) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	int res = on_header_field(parser, sp->span_at ? sp->span_at : "", sp->span_len);
+	stream_span_clear(sp);
+	return stream_cb_result(sp, res);
+}
+static int stream_header_value_complete_cb(llhttp_t* parser) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	int res = on_header_value(parser, sp->span_at ? sp->span_at : "", sp->span_len);
+	stream_span_clear(sp);
+	return stream_cb_result(sp, res);
+}
+// 报文头结束时报告之前回调中记录的错误，否则停在报文头结尾，body 留给调用者
+static int stream_headers_complete_result(HttpStreamParser* sp) {
+	if (sp->cb_error_reason)
+	{
+		llhttp_set_error_reason(&(sp->parser), sp->cb_error_reason);
+		return -1;
+	}
+	sp->done = 1;
+	return HPE_PAUSED;
+}
+static int stream_headers_complete_cb(llhttp_t* parser) {
+	headers_complete_cb(parser);
+	return stream_headers_complete_result((HttpStreamParser*)parser);
+}
+HttpStreamParser* new_http_stream_parser(int is_response) {
+	HttpStreamParser* sp = zero_malloc(sizeof(HttpStreamParser));
+	if (!sp)
+	{
+		return NULL;
+	}
+	llhttp_settings_init(&(sp->settings));
+	sp->settings.on_url = stream_span_cb;
+	sp->settings.on_url_complete = stream_url_complete_cb;
+	sp->settings.on_status = status_cb;
+	sp->settings.on_header_field = stream_span_cb;
+	sp->settings.on_header_field_complete = stream_header_field_complete_cb;
+	sp->settings.on_header_value = stream_span_cb;
+	sp->settings.on_header_value_complete = stream_header_value_complete_cb;
+	sp->settings.on_headers_complete = stream_headers_complete_cb;
+	llhttp_init(&(sp->parser), is_response ? HTTP_RESPONSE : HTTP_REQUEST, &(sp->settings));
+	sp->message = makeHttpMessage();
+	sp->parser.data = &(sp->message);
+	return sp;
+}
+void delete_http_stream_parser(HttpStreamParser* sp, HttpStreamParser** sp_addr) {
+	if (sp_addr)
+	{
+		*sp_addr = NULL;
+	}
+	if (!sp)
+	{
+		return;
+	}
+	freeHttpMessage(&(sp->message));
+	free(sp->span_buf); sp->span_buf = NULL;
+	free(sp);
+}
+int feed_http_stream_parser(HttpStreamParser* sp, const char* data, size_t len, size_t* consumed_p) {
+	size_t nothing;
+	consumed_p == NULL ? (consumed_p = &nothing) : (consumed_p);
+	*consumed_p = 0;
+	if (sp->done)
+	{
+		return 1;
+	}
+	// 报文头最长 MAX_HTTP_HEADERS_LENGTH 个字节
+	int overflow = 0;
+	size_t feed_len = len;
+	if (sp->fed_len + feed_len > MAX_HTTP_HEADERS_LENGTH)
+	{
+		feed_len = MAX_HTTP_HEADERS_LENGTH - sp->fed_len;
+		overflow = 1;
+	}
+	enum llhttp_errno err = llhttp_execute(&(sp->parser), data, feed_len);
+	if (err == HPE_PAUSED && sp->done)
+	{
+		// success
+		*consumed_p = llhttp_get_error_pos(&(sp->parser)) - data;
+		sp->message.success = 1;
+		return 1;
+	}
+	else if (err == HPE_OK && !overflow)
+	{
+		*consumed_p = feed_len;
+		sp->fed_len += feed_len;
+		// 没结束的片段指向调用者的数据，下次 feed 时这块数据可能已经失效了
+		if (sp->span_len > 0 && !(sp->span_owned) && !stream_span_own(sp, 0))
+		{
+			sp->message.malloc_success = 0;
+			sp->done = 1;
+			return 1;
+		}
+		return 0;
+	}
+	// fail
+	// 回调中的错误在报文头结尾才报告，报文头之后的数据仍然完好；其他错误丢弃整块数据
+	*consumed_p = (sp->cb_error_reason && err != HPE_OK) ? (size_t)(llhttp_get_error_pos(&(sp->parser)) - data) : len;
+	sp->done = 1;
+	if (sp->message.malloc_success)
+	{
+		if (err == HPE_OK)
+		{
+			set_parse_error(&(sp->message), "HPE_HEADER_OVERFLOW", "Header overflow");
+		}
+		else if (sp->cb_error_reason)
+		{
+			set_parse_error(&(sp->message), "HPE_USER", sp->cb_error_reason);
+		}
+		else
+		{
+			set_parse_error(&(sp->message), llhttp_errno_name(err), sp->parser.reason);
+		}
+	}
+	return 1;
+}
+HttpMessage take_http_stream_message(HttpStreamParser* sp) {
+	HttpMessage httpmsg = sp->message;
+	sp->message = makeHttpMessage();
+	sp->done = 0;
+	sp->fed_len = 0;
+	sp->cb_error_reason = NULL;
+	stream_span_clear(sp);
+	llhttp_reset(&(sp->parser));
 	return httpmsg;
 }
+
+static int slice_case_equal(HttpSlice slice, const char* str) {
+	size_t slen = strlen(str);
+	if (slice.len != slen)
+	{
+		return 0;
+	}
+	for (size_t i = 0; i < slen; i++)
+	{
+		if (toupper((unsigned char)slice.at[i]) != toupper((unsigned char)str[i]))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+static void slice_rebase(HttpSlice* slice, const char* old_base, const char* new_base) {
+	if (slice->at)
+	{
+		slice->at = new_base + (slice->at - old_base);
+	}
+}
+static void kvs_rebase(HttpSliceKV* kvs, int num, const char* old_base, const char* new_base) {
+	for (int i = 0; i < num; i++)
+	{
+		slice_rebase(&(kvs[i].field), old_base, new_base);
+		slice_rebase(&(kvs[i].value), old_base, new_base);
+	}
+}
+// 调用者移动了报文（例如整理接收缓冲区），让所有已解析出的视图指向新的位置
+static void view_rebase(HttpStreamParser* sp, const char* new_base) {
+	const char* old_base = sp->view_base;
+	HttpMessageView* view = &(sp->view);
+	slice_rebase(&(view->url), old_base, new_base);
+	slice_rebase(&(view->path), old_base, new_base);
+	kvs_rebase(view->query_string, view->query_string_num, old_base, new_base);
+	kvs_rebase(view->url_fragment, view->url_fragment_num, old_base, new_base);
+	kvs_rebase(view->http_headers, view->http_headers_num, old_base, new_base);
+	slice_rebase(&(view->location), old_base, new_base);
+	if (sp->span_at)
+	{
+		sp->span_at = new_base + (sp->span_at - old_base);
+	}
+	sp->view_base = new_base;
+}
+// 按 '&' 拆分，每一项按第一个 '=' 拆分为字段和值，空的项被忽略
+static int view_split_kv(const char* p, const char* end, HttpSliceKV* kvs, int max_num, int* num_p) {
+	while (p < end)
+	{
+		const char* amp = memchr(p, '&', end - p);
+		amp = amp ? amp : end;
+		if (amp > p)
+		{
+			if (*num_p >= max_num)
+			{
+				return 0;
+			}
+			const char* eq = memchr(p, '=', amp - p);
+			HttpSliceKV* kv = &(kvs[(*num_p)++]);
+			kv->field = (HttpSlice){ .at = p, .len = (eq ? eq : amp) - p };
+			kv->value = eq ? (HttpSlice) { .at = eq + 1, .len = amp - eq - 1 } : (HttpSlice) { .at = amp, .len = 0 };
+		}
+		p = amp + 1;
+	}
+	return 1;
+}
+static unsigned int query_hash(const char* field, size_t len) {
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)field[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+// 返回字段所在的槽或应该插入的空槽
+static int query_index_slot(const HttpMessageView* view, const char* field, size_t len) {
+	unsigned int slot = query_hash(field, len) & (HTTP_VIEW_QUERY_INDEX_SIZE - 1);
+	while (view->query_index[slot])
+	{
+		HttpSlice indexed = view->query_string[view->query_index[slot] - 1].field;
+		if (indexed.len == len && !memcmp(indexed.at, field, len))
+		{
+			break;
+		}
+		slot = (slot + 1) & (HTTP_VIEW_QUERY_INDEX_SIZE - 1);
+	}
+	return (int)slot;
+}
+static void view_index_queries(HttpMessageView* view) {
+	for (int i = 0; i < view->query_string_num; i++)
+	{
+		HttpSlice field = view->query_string[i].field;
+		view->query_index[query_index_slot(view, field.at, field.len)] = (unsigned char)(i + 1);
+	}
+}
+static int view_span_cb(llhttp_t* parser, const char* at, size_t length) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	if (!(sp->span_at))
+	{
+		sp->span_at = at;
+	}
+	// 同一个片段在报文中是连续的，即使它被分多次回调
+	sp->span_len = (at + length) - sp->span_at;
+	return 0;
+}
+static HttpSlice view_take_span(HttpStreamParser* sp, const char* empty_at) {
+	HttpSlice slice = { .at = sp->span_at ? sp->span_at : empty_at, .len = sp->span_len };
+	sp->span_at = NULL;
+	sp->span_len = 0;
+	return slice;
+}
+static int view_url_complete_cb(llhttp_t* parser) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	HttpMessageView* view = &(sp->view);
+	view->method = httpMethodFromStr(llhttp_method_name(parser->method));
+	view->url = view_take_span(sp, sp->view_base);
+	const char* url = view->url.at;
+	const char* url_end = url + view->url.len;
+	const char* question_mark = memchr(url, '?', url_end - url);
+	const char* number_sign_after = question_mark ? question_mark : url;
+	const char* number_sign = memchr(number_sign_after, '#', url_end - number_sign_after);
+	const char* path_end = question_mark ? question_mark : (number_sign ? number_sign : url_end);
+	view->path = (HttpSlice){ .at = url, .len = path_end - url };
+	if (question_mark && !view_split_kv(question_mark + 1, number_sign ? number_sign : url_end, view->query_string, HTTP_VIEW_MAX_QUERIES, &(view->query_string_num)))
+	{
+		return record_cb_error(sp, "Too many query parameters");
+	}
+	view_index_queries(view);
+	if (number_sign && !view_split_kv(number_sign + 1, url_end, view->url_fragment, HTTP_VIEW_MAX_FRAGMENTS, &(view->url_fragment_num)))
+	{
+		return record_cb_error(sp, "Too many fragment parameters");
+	}
+	return 0;
+}
+static int view_status_cb(llhttp_t* parser, const char* at, size_t length) {
+	((HttpStreamParser*)parser)->view.status_code = parser->status_code;
+	return 0;
+}
+static int view_header_field_complete_cb(llhttp_t* parser) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	HttpMessageView* view = &(sp->view);
+	if (view->http_headers_num >= HTTP_VIEW_MAX_HEADERS)
+	{
+		return record_cb_error(sp, "Too many headers");
+	}
+	HttpSliceKV* header = &(view->http_headers[view->http_headers_num++]);
+	header->field = view_take_span(sp, sp->view_base);
+	header->value = (HttpSlice){ .at = header->field.at + header->field.len, .len = 0 };
+	return 0;
+}
+static int view_header_value_complete_cb(llhttp_t* parser) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	HttpMessageView* view = &(sp->view);
+	if (view->http_headers_num <= 0)
+	{
+		return record_cb_error(sp, "Header value without field");
+	}
+	HttpSliceKV* header = &(view->http_headers[view->http_headers_num - 1]);
+	// 空的值没有 on_header_value 回调，保持指向字段结尾的空视图
+	header->value = view_take_span(sp, header->value.at);
+	if (slice_case_equal(header->field, "location"))
+	{
+		view->location = header->value;
+	}
+	return 0;
+}
+static int view_headers_complete_cb(llhttp_t* parser) {
+	HttpStreamParser* sp = (HttpStreamParser*)parser;
+	HttpMessageView* view = &(sp->view);
+	view->http_major = parser->http_major;
+	view->http_minor = parser->http_minor;
+	if (parser->flags & F_CONTENT_LENGTH)
+	{
+		view->content_length = (long long)parser->content_length;
+	}
+	return stream_headers_complete_result(sp);
+}
+HttpStreamParser* new_http_view_parser(int is_response) {
+	HttpStreamParser* sp = zero_malloc(sizeof(HttpStreamParser));
+	if (!sp)
+	{
+		return NULL;
+	}
+	llhttp_settings_init(&(sp->settings));
+	sp->settings.on_url = view_span_cb;
+	sp->settings.on_url_complete = view_url_complete_cb;
+	sp->settings.on_status = view_status_cb;
+	sp->settings.on_header_field = view_span_cb;
+	sp->settings.on_header_field_complete = view_header_field_complete_cb;
+	sp->settings.on_header_value = view_span_cb;
+	sp->settings.on_header_value_complete = view_header_value_complete_cb;
+	sp->settings.on_headers_complete = view_headers_complete_cb;
+	llhttp_init(&(sp->parser), is_response ? HTTP_RESPONSE : HTTP_REQUEST, &(sp->settings));
+	sp->message = makeHttpMessage();
+	sp->parser.data = NULL;
+	return sp;
+}
+int feed_http_view_parser(HttpStreamParser* sp, const char* message, size_t len, size_t* consumed_p) {
+	size_t nothing;
+	consumed_p == NULL ? (consumed_p = &nothing) : (consumed_p);
+	*consumed_p = 0;
+	if (sp->done)
+	{
+		return 1;
+	}
+	if (sp->fed_len == 0)
+	{
+		// 新的报文，上一个报文的视图从此失效
+		sp->view = (HttpMessageView){ .success = 1, .method = INVALID_METHOD };
+		sp->view_base = message;
+	}
+	else if (message != sp->view_base)
+	{
+		view_rebase(sp, message);
+	}
+	if (len <= sp->fed_len)
+	{
+		return 0;
+	}
+	// 报文头最长 MAX_HTTP_HEADERS_LENGTH 个字节
+	int overflow = 0;
+	size_t feed_len = len - sp->fed_len;
+	if (len > MAX_HTTP_HEADERS_LENGTH)
+	{
+		feed_len = MAX_HTTP_HEADERS_LENGTH > sp->fed_len ? MAX_HTTP_HEADERS_LENGTH - sp->fed_len : 0;
+		overflow = 1;
+	}
+	enum llhttp_errno err = llhttp_execute(&(sp->parser), message + sp->fed_len, feed_len);
+	if (err == HPE_PAUSED && sp->done)
+	{
+		// success
+		*consumed_p = llhttp_get_error_pos(&(sp->parser)) - message;
+		return 1;
+	}
+	else if (err == HPE_OK && !overflow)
+	{
+		sp->fed_len += feed_len;
+		return 0;
+	}
+	// fail
+	// 回调中的错误在报文头结尾才报告，报文头之后的数据仍然完好；其他错误丢弃整块数据
+	*consumed_p = (sp->cb_error_reason && err != HPE_OK) ? (size_t)(llhttp_get_error_pos(&(sp->parser)) - message) : len;
+	sp->done = 1;
+	sp->view.success = 0;
+	if (err == HPE_OK)
+	{
+		sp->view.error_name = "HPE_HEADER_OVERFLOW";
+		sp->view.error_reason = "Header overflow";
+	}
+	else if (sp->cb_error_reason)
+	{
+		sp->view.error_name = "HPE_USER";
+		sp->view.error_reason = sp->cb_error_reason;
+	}
+	else
+	{
+		sp->view.error_name = llhttp_errno_name(err);
+		sp->view.error_reason = sp->parser.reason ? sp->parser.reason : "";
+	}
+	return 1;
+}
+const HttpMessageView* take_http_message_view(HttpStreamParser* sp) {
+	sp->done = 0;
+	sp->fed_len = 0;
+	sp->cb_error_reason = NULL;
+	sp->span_at = NULL;
+	sp->span_len = 0;
+	llhttp_reset(&(sp->parser));
+	return &(sp->view);
+}
+HttpSlice find_http_slice_kv(const HttpSliceKV* kvs, int num, const char* field) {
+	HttpSlice found = { .at = NULL, .len = 0 };
+	for (int i = 0; i < num; i++)
+	{
+		if (http_slice_equal(kvs[i].field, field))
+		{
+			found = kvs[i].value;
+		}
+	}
+	return found;
+}
+HttpSlice http_view_header(const HttpMessageView* view, const char* field) {
+	HttpSlice found = { .at = NULL, .len = 0 };
+	size_t flen = strlen(field);
+	for (int i = 0; i < view->http_headers_num; i++)
+	{
+		HttpSlice name = view->http_headers[i].field;
+		if (name.len != flen)
+		{
+			continue;
+		}
+		size_t j = 0;
+		while (j < flen && tolower((unsigned char)name.at[j]) == tolower((unsigned char)field[j]))
+		{
+			j++;
+		}
+		if (j == flen)
+		{
+			found = view->http_headers[i].value;
+		}
+	}
+	return found;
+}
+HttpSlice http_view_query(const HttpMessageView* view, const char* field) {
+	HttpSlice found = { .at = NULL, .len = 0 };
+	int index = view->query_index[query_index_slot(view, field, strlen(field))];
+	if (index)
+	{
+		found = view->query_string[index - 1].value;
+	}
+	return found;
+}
+int http_view_query_int(const HttpMessageView* view, const char* field, int* value_p) {
+	long long value = 0;
+	if (!http_slice_to_ll(http_view_query(view, field), &value) || value < INT_MIN || value > INT_MAX)
+	{
+		return 0;
+	}
+	*value_p = (int)value;
+	return 1;
+}
+int http_view_query_ll(const HttpMessageView* view, const char* field, long long* value_p) {
+	return http_slice_to_ll(http_view_query(view, field), value_p);
+}
+int http_slice_equal(HttpSlice slice, const char* str) {
+	size_t slen = strlen(str);
+	return slice.at && slice.len == slen && !memcmp(slice.at, str, slen);
+}
+int http_slice_case_equal(HttpSlice slice, const char* str) {
+	return slice.at && slice_case_equal(slice, str);
+}
+int http_slice_to_ll(HttpSlice slice, long long* value_p) {
+	if (!slice.at || slice.len == 0)
+	{
+		return 0;
+	}
+	size_t i = 0;
+	int negative = 0;
+	if (slice.at[0] == '-' || slice.at[0] == '+')
+	{
+		negative = (slice.at[0] == '-');
+		i++;
+	}
+	if (i >= slice.len)
+	{
+		return 0;
+	}
+	unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1ULL : (unsigned long long)LLONG_MAX;
+	unsigned long long value = 0;
+	for (; i < slice.len; i++)
+	{
+		char ch = slice.at[i];
+		if (ch < '0' || ch > '9')
+		{
+			return 0;
+		}
+		unsigned long long digit = (unsigned long long)(ch - '0');
+		if (value > (limit - digit) / 10ULL)
+		{
+			return 0;
+		}
+		value = value * 10ULL + digit;
+	}
+	*value_p = negative ? (long long)(0ULL - value) : (long long)value;
+	return 1;
+}
+int http_slice_copy(HttpSlice slice, char* buf, size_t buf_len) {
+	if (!slice.at || slice.len + 1 > buf_len)
+	{
+		return 0;
+	}
+	memcpy(buf, slice.at, slice.len);
+	buf[slice.len] = '\0';
+	return 1;
+}
 #endif // CASE_INSENSITIVE_STRCMP
 
 #ifdef __cplusplus
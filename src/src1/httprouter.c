@@ -0,0 +1,240 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "httprouter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vutils.h"
+
+#define METHOD_SLOT_NUM (HTTP_RESPONSE_ + 1)
+#define ANY_METHOD_SLOT INVALID_METHOD
+
+typedef struct radix_node {
+	// 从父节点走到此节点需要匹配的字符串，根节点为空
+	char* label;
+	size_t label_len;
+	// 按 label 的第一个字节排序，查找时二分
+	struct radix_node** children;
+	int children_num;
+	void* exact[METHOD_SLOT_NUM];
+	void* prefix[METHOD_SLOT_NUM];
+} radix_node;
+
+struct HttpRouter {
+	radix_node* root;
+};
+
+static radix_node* new_radix_node(const char* label, size_t label_len) {
+	radix_node* node = zero_malloc(sizeof(radix_node));
+	if (!node)
+	{
+		return NULL;
+	}
+	node->label = zero_malloc(label_len + 1);
+	if (!(node->label))
+	{
+		free(node);
+		return NULL;
+	}
+	memcpy(node->label, label, label_len);
+	node->label_len = label_len;
+	return node;
+}
+
+static void delete_radix_node(radix_node* node) {
+	if (!node)
+	{
+		return;
+	}
+	for (int i = 0; i < node->children_num; i++)
+	{
+		delete_radix_node(node->children[i]);
+	}
+	free(node->children);
+	free(node->label);
+	free(node);
+}
+
+// 返回第一个字节为 ch 的子节点的下标，找不到时返回 -(应插入的位置 + 1)
+static int find_child(const radix_node* node, unsigned char ch) {
+	int low = 0, high = node->children_num - 1;
+	while (low <= high)
+	{
+		int mid = low + (high - low) / 2;
+		unsigned char mid_ch = (unsigned char)node->children[mid]->label[0];
+		if (mid_ch == ch)
+		{
+			return mid;
+		}
+		else if (mid_ch < ch)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+	return -(low + 1);
+}
+
+static int insert_child(radix_node* node, int index, radix_node* child) {
+	radix_node** children = realloc(node->children, sizeof(radix_node*) * (node->children_num + 1));
+	if (!children)
+	{
+		return 0;
+	}
+	memmove(children + index + 1, children + index, sizeof(radix_node*) * (node->children_num - index));
+	children[index] = child;
+	node->children = children;
+	node->children_num++;
+	return 1;
+}
+
+// 把 child 从第 at 个字节处拆成两段，返回前一段（新的节点），它替换 child 在父节点中的位置
+static radix_node* split_node(radix_node* parent, int child_index, size_t at) {
+	radix_node* child = parent->children[child_index];
+	radix_node* mid = new_radix_node(child->label, at);
+	if (!mid)
+	{
+		return NULL;
+	}
+	char* rest = zero_malloc(child->label_len - at + 1);
+	mid->children = malloc(sizeof(radix_node*));
+	if (!rest || !(mid->children))
+	{
+		free(rest);
+		delete_radix_node(mid);
+		return NULL;
+	}
+	memcpy(rest, child->label + at, child->label_len - at);
+	free(child->label);
+	child->label = rest;
+	child->label_len -= at;
+	mid->children[0] = child;
+	mid->children_num = 1;
+	parent->children[child_index] = mid;
+	return mid;
+}
+
+HttpRouter* new_http_router() {
+	HttpRouter* router = zero_malloc(sizeof(HttpRouter));
+	if (!router)
+	{
+		return NULL;
+	}
+	router->root = new_radix_node("", 0);
+	if (!(router->root))
+	{
+		free(router);
+		return NULL;
+	}
+	return router;
+}
+
+void delete_http_router(HttpRouter* router, HttpRouter** router_addr) {
+	if (router)
+	{
+		delete_radix_node(router->root);
+		free(router);
+	}
+	if (router_addr)
+	{
+		*router_addr = NULL;
+	}
+}
+
+int http_router_add(HttpRouter* router, const char* path, HttpRouteType type, HttpMethod method, void* value) {
+	if (!path || !value || !(*path))
+	{
+		return -1;
+	}
+	int slot = (method >= GET && method < INVALID_METHOD) ? method : ANY_METHOD_SLOT;
+	radix_node* node = router->root;
+	const char* rest = path;
+	size_t rest_len = strlen(path);
+	while (rest_len > 0)
+	{
+		int index = find_child(node, (unsigned char)rest[0]);
+		if (index < 0)
+		{
+			radix_node* leaf = new_radix_node(rest, rest_len);
+			if (!leaf)
+			{
+				return -2;
+			}
+			if (!insert_child(node, -index - 1, leaf))
+			{
+				delete_radix_node(leaf);
+				return -2;
+			}
+			node = leaf;
+			break;
+		}
+		radix_node* child = node->children[index];
+		size_t common = 0;
+		while (common < child->label_len && common < rest_len && child->label[common] == rest[common])
+		{
+			common++;
+		}
+		if (common < child->label_len)
+		{
+			child = split_node(node, index, common);
+			if (!child)
+			{
+				return -2;
+			}
+		}
+		node = child;
+		rest += common;
+		rest_len -= common;
+	}
+	(type == HTTP_ROUTE_PREFIX ? node->prefix : node->exact)[slot] = value;
+	return 0;
+}
+
+static void* pick_method(void* const* slots, HttpMethod method) {
+	if (method >= GET && method < INVALID_METHOD && slots[method])
+	{
+		return slots[method];
+	}
+	return slots[ANY_METHOD_SLOT];
+}
+
+void* http_router_match(const HttpRouter* router, const char* path, size_t path_len, HttpMethod method) {
+	const radix_node* node = router->root;
+	size_t pos = 0;
+	void* best_prefix = NULL;
+	while (1)
+	{
+		// 每条路由都结束在某个节点上，所以只需要在节点处检查
+		void* prefix = pick_method(node->prefix, method);
+		if (prefix)
+		{
+			best_prefix = prefix;
+		}
+		if (pos == path_len)
+		{
+			void* exact = pick_method(node->exact, method);
+			return exact ? exact : best_prefix;
+		}
+		int index = find_child(node, (unsigned char)path[pos]);
+		if (index < 0)
+		{
+			return best_prefix;
+		}
+		const radix_node* child = node->children[index];
+		if (path_len - pos < child->label_len || memcmp(path + pos, child->label, child->label_len))
+		{
+			return best_prefix;
+		}
+		pos += child->label_len;
+		node = child;
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
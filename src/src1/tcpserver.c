@@ -10,7 +10,9 @@ extern "C" {
 #include "vutils.h"
 #include "vlist.h"
 #include "httputils.h"
+#include "vsha256.h"
 #include "httpparser.h"
+#include "httprouter.h"
 #include "macros.h"
 
 #include <winsock2.h>
@@ -25,6 +27,21 @@ extern "C" {
 
 #define DEFAULT_RECV_TIMEOUT_S 15
 #define DEFAULT_SEND_TIMEOUT_S 15
+#define REQUEST_ARENA_BLOCK_SIZE 16384
+#define RECV_BUFFER_SIZE 32768 // 必须能容纳 MAX_HTTP_HEADERS_LENGTH 字节的报文头，报文视图指向这里
+#define RECEIVE_FILE_BUFFER_SIZE 512000 // receive_file() 的两个缓冲区各自的大小
+#define RECEIVE_FILE_TEMP_SUFFIX ".part" // receive_file() 接收过程中使用的临时文件名后缀，连接中断时保留，用于续传
+#define UPLOAD_OFFSET_HEADER "Upload-Offset" // 续传时告诉客户端服务器已经收到的字节数
+#define RECEIVE_FILE_DIGEST_SUFFIX ".sha256" // receive_file() 保存文件哈希的文件名后缀
+#define FILE_HD_OVERLAPPED 1 // get_file_hd()：以异步 I/O 方式打开
+#define FILE_HD_KEEP_CONTENT 2 // get_file_hd()：只写时打开已存在的文件并保留内容，而不是清空或创建
+#define FILE_CACHE_CAPACITY (512ULL * 1024ULL * 1024ULL) // 文件缓存的总大小上限
+#define FILE_CACHE_MAX_FILE_SIZE (64ULL * 1024ULL * 1024ULL) // 超过此大小的文件不缓存，直接从磁盘发送
+#define FILE_CACHE_REVALIDATE_MS 1000ULL // 缓存项检查文件是否被修改的最小间隔
+#define EXPECT_HEADER "Expect" // 客户端发送 body 之前等待服务器同意
+#define EXPECT_100_CONTINUE "100-continue" // 唯一支持的 Expect 值
+#define DISCARD_BODY_MAX_SIZE (1024LL * 1024LL) // 处理函数没有读取的 body 超过此大小时关闭连接，而不是接收并丢弃它
+#define BULK_SEND_CHUNK_SIZE 65536ULL // 截止模式下 BULK 请求每次发送的最大字节数，发送速率按此粒度控制
 
 typedef struct tcp_node {
 	VLISTNODE
@@ -34,6 +51,28 @@ typedef struct tcp_node {
 	int open;
 	long recv_timeout_s;
 	long send_timeout_s;
+	// 上一次真正设置到 socket 上的阻塞模式和超时时间，没变化时不再重复调用 ioctlsocket() 和 setsockopt()，-1 表示尚未设置
+	long applied_recv_timeout_s;
+	long applied_send_timeout_s;
+	int blocking_applied;
+	// 接收缓冲区：一次 recv() 尽量多读，报文头直接从这里喂给解析器，处理请求时报文视图也指向这里，多读到的数据（例如流水线中的下一个请求或 body）留给后续的读取
+	char* recv_buf;
+	int recv_buf_start;
+	int recv_buf_end;
+	// 连接的流式 HTTP 解析器，接收缓冲区中的数据直接喂给它
+	HttpStreamParser* http_parser;
+	// 请求级别的内存池，每个连接一个，所以连接线程之间不会争用堆
+	varena arena;
+	// 正在处理的请求的调度类别
+	HttpPriorityClass priority_class;
+	// 上一次真正设置到连接线程上的优先级，没变化时不再重复调用 SetThreadPriority()
+	int applied_thread_priority;
+	// 正在处理的请求占用了截止模式下的一个 BULK 空位
+	int holds_bulk_slot;
+	// 正在处理的请求还没有被读取的 body 字节数，通过 recv_t() 读取时递减
+	long long body_remaining;
+	// 正在处理的请求带有 Expect: 100-continue，且还没有回复 100 Continue
+	int continue_pending;
 } tcp_node;
 typedef tcp_node node;
 typedef struct file_handle {
@@ -57,7 +96,7 @@ static int init_winsock() {
 
 typedef struct params {
 	node* node_p;
-	vlist http_handlers;
+	const HttpRouter* router;
 	const char* phrase_200;
 	const char* html_200;
 	const char* phrase_400;
@@ -96,6 +135,10 @@ static int clean_up_connection(node *connection_p, params *params_p, int returne
 		LogMe.et("CloseHandle( %p ) [tid = %lu ] failed with error: %lu", connection_p->handle, connection_p->tid, GetLastError());
 	}
 	LogMe.nt("Connection thread [tid = %lu ] [client socket = %p ] exit.", connection_p->tid, connection_p->socket);
+	free(connection_p->recv_buf); connection_p->recv_buf = NULL;
+	delete_http_stream_parser(connection_p->http_parser, &(connection_p->http_parser));
+	delete_varena(connection_p->arena, &(connection_p->arena));
+	connection_p->recv_buf_start = connection_p->recv_buf_end = 0;
 	connection_p->open = 0;
 	free(params_p);
 	return returned;
@@ -112,21 +155,28 @@ static char16_t *get_utf_16_file_name_from_utf8(const char* u8fn) {
 	return w_fn;
 }
 
-// 获取文件句柄，返回 NULL 表示失败，否则返回指定文件的句柄
-static file_handle get_file_hd(const char *filename, int read_only_1_or_write_only_0) {
+// 把 UTF-8 文件名转换为带 \\?\\ 前缀的 UTF-16 路径，返回 NULL 表示内存不足，否则调用者负责 free() 返回值
+static char16_t* get_wide_path(const char* filename) {
 	const char* prefix = "\\\\?\\";
 	const char* suffix = "";
 	char* fn_temp = zero_malloc(strlen(filename) + strlen(prefix) + strlen(suffix) + 1);
 	if (fn_temp == NULL)
 	{
-		LogMe.et("Open file [ %s ] failed with error: Malloc Fail", filename);
-		return (file_handle) { .handle = NULL };
+		return NULL;
 	}
 	strcat(fn_temp, prefix);
 	strcat(fn_temp, filename);
 	strcat(fn_temp, suffix);
 	char16_t* wide_filename = get_utf_16_file_name_from_utf8(fn_temp);
 	free(fn_temp); fn_temp = NULL;
+	return wide_filename;
+}
+
+// 获取文件句柄，返回 NULL 表示失败，否则返回指定文件的句柄
+// flags 包含 FILE_HD_OVERLAPPED 时以异步 I/O 方式打开，读写必须通过 OVERLAPPED 结构体指定偏移；
+// 包含 FILE_HD_KEEP_CONTENT 时只写方式只打开已存在的文件且不清空
+static file_handle get_file_hd(const char *filename, int read_only_1_or_write_only_0, int flags) {
+	char16_t* wide_filename = get_wide_path(filename);
 	if (wide_filename == NULL)
 	{
 		LogMe.et("Open file [ %s ] failed with error: Malloc Fail", filename);
@@ -137,8 +187,8 @@ static file_handle get_file_hd(const char *filename, int read_only_1_or_write_on
 		read_only_1_or_write_only_0?GENERIC_READ:GENERIC_WRITE,			// 只读（只写）
 		read_only_1_or_write_only_0?FILE_SHARE_READ:0,					// 可以和其它进程一起读（读共享）（不能共享）
 		NULL,															// lpSecurityAttributes 参数的默认值
-		read_only_1_or_write_only_0?OPEN_EXISTING:CREATE_ALWAYS,		// 只有存在时才打开，否则失败（存在则清空，不存在则创建）
-		FILE_ATTRIBUTE_NORMAL,											// 普通文件
+		(read_only_1_or_write_only_0 || (flags & FILE_HD_KEEP_CONTENT))?OPEN_EXISTING:CREATE_ALWAYS,	// 只有存在时才打开，否则失败（存在则清空，不存在则创建）
+		FILE_ATTRIBUTE_NORMAL | ((flags & FILE_HD_OVERLAPPED) ? FILE_FLAG_OVERLAPPED : 0),	// 普通文件（异步 I/O）
 		NULL															// hTemplateFile 参数的默认值
 	);
 	free(wide_filename); wide_filename = NULL;
@@ -211,10 +261,290 @@ static int error_shutdown(node* cnt_p, params* params_p, int returned) {
 	return clean_up_connection(cnt_p, params_p, returned);
 }
 
+// 截止模式的调度状态，由 tcp_server_set_deadline_mode() 设置
+static SRWLOCK scheduler_lock = SRWLOCK_INIT;
+// 等待 BULK 空位的请求在此等待
+static CONDITION_VARIABLE scheduler_cv = CONDITION_VARIABLE_INIT;
+static volatile LONG deadline_mode = 0;
+static int deadline_bulk_slots = 0;
+static int deadline_bulk_running = 0;
+static unsigned long long deadline_bulk_bytes_per_s = 0;
+// 所有 BULK 请求共享的发送额度（字节），随时间按 deadline_bulk_bytes_per_s 恢复，为负表示已经超发
+static long long bulk_send_credit = 0;
+static ULONGLONG bulk_credit_tick = 0;
+
+void tcp_server_set_deadline_mode(int on, int bulk_slots, unsigned long long bulk_bytes_per_s) {
+	AcquireSRWLockExclusive(&scheduler_lock);
+	int was_on = deadline_mode;
+	deadline_bulk_slots = bulk_slots > 0 ? bulk_slots : 1;
+	deadline_bulk_bytes_per_s = bulk_bytes_per_s;
+	if (on && !was_on)
+	{
+		bulk_send_credit = 0;
+		bulk_credit_tick = GetTickCount64();
+	}
+	InterlockedExchange(&deadline_mode, on ? 1 : 0);
+	ReleaseSRWLockExclusive(&scheduler_lock);
+	// 退出截止模式或空位变多时，等待空位的请求可以继续
+	WakeAllConditionVariable(&scheduler_cv);
+	if (!was_on != !on)
+	{
+		LogMe.wt("deadline mode %s [bulk slots = %d ] [bulk send rate = %llu B/s ]", on ? "on" : "off", deadline_bulk_slots, bulk_bytes_per_s);
+	}
+}
+
+// 按正在处理的请求的调度类别和是否处于截止模式设置连接线程的优先级，只有优先级变化时才真正调用 SetThreadPriority()。
+// 每次收发之前调用，所以截止模式的切换对正在处理的请求也会很快生效。
+static void apply_thread_priority(node* np) {
+	int priority = THREAD_PRIORITY_NORMAL;
+	if (deadline_mode)
+	{
+		switch (np->priority_class)
+		{
+		case HTTP_PRIORITY_URGENT:
+			priority = THREAD_PRIORITY_ABOVE_NORMAL;
+			break;
+		case HTTP_PRIORITY_LOW:
+		case HTTP_PRIORITY_BULK:
+			priority = THREAD_PRIORITY_BELOW_NORMAL;
+			break;
+		default:
+			break;
+		}
+	}
+	if (np->applied_thread_priority != priority)
+	{
+		if (!SetThreadPriority(GetCurrentThread(), priority))
+		{
+			LogMe.et("SetThreadPriority( %d ) for socket [ %p ] failed with error: %lu", priority, np->socket, GetLastError());
+		}
+		np->applied_thread_priority = priority;
+	}
+}
+
+// 处理请求之前调用：记下请求的调度类别，截止模式下 BULK 请求先等待一个空位
+static void begin_scheduled_request(node* np, HttpPriorityClass priority_class) {
+	np->priority_class = priority_class;
+	if (priority_class == HTTP_PRIORITY_BULK && deadline_mode)
+	{
+		ULONGLONG start_tick = GetTickCount64();
+		AcquireSRWLockExclusive(&scheduler_lock);
+		while (deadline_mode && deadline_bulk_running >= deadline_bulk_slots)
+		{
+			SleepConditionVariableSRW(&scheduler_cv, &scheduler_lock, INFINITE, 0);
+		}
+		if (deadline_mode)
+		{
+			deadline_bulk_running++;
+			np->holds_bulk_slot = 1;
+		}
+		ReleaseSRWLockExclusive(&scheduler_lock);
+		LogMe.it("socket [ %p ] waited %llu ms for a bulk slot", np->socket, GetTickCount64() - start_tick);
+	}
+	apply_thread_priority(np);
+}
+
+// 请求处理完之后调用：归还 BULK 空位，恢复连接线程的优先级
+static void end_scheduled_request(node* np) {
+	if (np->holds_bulk_slot)
+	{
+		AcquireSRWLockExclusive(&scheduler_lock);
+		deadline_bulk_running--;
+		ReleaseSRWLockExclusive(&scheduler_lock);
+		WakeConditionVariable(&scheduler_cv);
+		np->holds_bulk_slot = 0;
+	}
+	np->priority_class = HTTP_PRIORITY_NORMAL;
+	apply_thread_priority(np);
+}
+
+// 截止模式下 BULK 请求一次最多发送的字节数，不限速时返回 0
+static unsigned long long bulk_send_limit(node* np) {
+	return np->priority_class == HTTP_PRIORITY_BULK && deadline_mode && deadline_bulk_bytes_per_s > 0 ? BULK_SEND_CHUNK_SIZE : 0;
+}
+
+// 从共享的发送额度中扣除 BULK 请求刚刚发送的字节数，额度不够时睡眠到额度恢复为止
+static void charge_bulk_send(node* np, unsigned long long sent) {
+	if (!bulk_send_limit(np))
+	{
+		return;
+	}
+	AcquireSRWLockExclusive(&scheduler_lock);
+	unsigned long long rate = deadline_bulk_bytes_per_s;
+	if (rate == 0)
+	{
+		ReleaseSRWLockExclusive(&scheduler_lock);
+		return;
+	}
+	ULONGLONG now = GetTickCount64();
+	bulk_send_credit += (long long)((now - bulk_credit_tick) * rate / 1000ULL);
+	bulk_credit_tick = now;
+	// 空闲时积攒的额度最多够发送一块，避免恢复发送时突发
+	if (bulk_send_credit > (long long)BULK_SEND_CHUNK_SIZE)
+	{
+		bulk_send_credit = (long long)BULK_SEND_CHUNK_SIZE;
+	}
+	bulk_send_credit -= (long long)sent;
+	long long debt = -bulk_send_credit;
+	ReleaseSRWLockExclusive(&scheduler_lock);
+	if (debt > 0)
+	{
+		Sleep((DWORD)((unsigned long long)debt * 1000ULL / rate));
+	}
+}
+
+// 只有阻塞模式或超时时间发生变化时才真正调用 ioctlsocket() 和 setsockopt()
+static void apply_blocking(node* np) {
+	if (!np->blocking_applied)
+	{
+		ioctlsocket(np->socket, FIONBIO, &((u_long) { 0 })); // 0:blocking 1:non-blocking
+		np->blocking_applied = 1;
+	}
+}
+
+static void apply_recv_timeout(node* np) {
+	apply_blocking(np);
+	apply_thread_priority(np);
+	if (np->applied_recv_timeout_s != np->recv_timeout_s)
+	{
+		setsockopt(np->socket, SOL_SOCKET, SO_RCVTIMEO, (char*)&((DWORD) { ((DWORD)(np->recv_timeout_s)) * 1000 }), sizeof(DWORD));
+		np->applied_recv_timeout_s = np->recv_timeout_s;
+	}
+}
+
+static void apply_send_timeout(node* np) {
+	apply_blocking(np);
+	apply_thread_priority(np);
+	if (np->applied_send_timeout_s != np->send_timeout_s)
+	{
+		setsockopt(np->socket, SOL_SOCKET, SO_SNDTIMEO, (char*)&((DWORD) { ((DWORD)(np->send_timeout_s)) * 1000 }), sizeof(DWORD));
+		np->applied_send_timeout_s = np->send_timeout_s;
+	}
+}
+
+// 接收缓冲区中还未被取走的字节数
+static int recv_buffered_len(node* np) {
+	return np->recv_buf_end - np->recv_buf_start;
+}
+
+// 把缓冲区中还未被取走的数据移到开头，再用一次 recv() 尽量填满剩下的空间，返回值与 recv() 相同
+static int fill_recv_buffer(node* np) {
+	if (!np->recv_buf)
+	{
+		np->recv_buf = malloc(RECV_BUFFER_SIZE);
+		if (!np->recv_buf)
+		{
+			LogMe.et("socket [ %p ] recv buffer Malloc failed", np->socket);
+			return SOCKET_ERROR;
+		}
+	}
+	int buffered = recv_buffered_len(np);
+	if (buffered > 0 && np->recv_buf_start > 0)
+	{
+		memmove(np->recv_buf, np->recv_buf + np->recv_buf_start, buffered);
+	}
+	np->recv_buf_start = 0; np->recv_buf_end = buffered;
+	if (buffered >= RECV_BUFFER_SIZE)
+	{
+		LogMe.et("socket [ %p ] recv buffer is full", np->socket);
+		return SOCKET_ERROR;
+	}
+	apply_recv_timeout(np);
+	int r_res = recv(np->socket, np->recv_buf + buffered, RECV_BUFFER_SIZE - buffered, 0);
+	if (r_res > 0)
+	{
+		np->recv_buf_end += r_res;
+	}
+	else if (r_res == 0)
+	{
+		LogMe.bt("call recv() on socket [ %p ] and recv 0", np->socket);
+	}
+	else if (r_res == SOCKET_ERROR)
+	{
+		LogMe.et("call recv() on socket [ %p ] with len=%d and return=SOCKET_ERROR <WSAGetLastError()=%d>", np->socket, RECV_BUFFER_SIZE - buffered, WSAGetLastError());
+	}
+	return r_res;
+}
+
+// 从正在处理的请求的 body 中取走了 len 字节
+static void consume_body(node* np, int len) {
+	np->body_remaining = np->body_remaining > len ? np->body_remaining - len : 0;
+}
+
+// 客户端带有 Expect: 100-continue 时，第一次读取 body 之前调用：回复 100 Continue，客户端收到后才开始发送 body。
+// 客户端没有等待、已经开始发送 body 时不再回复。成功返回 0，失败返回 non-zero
+static int send_continue(node* np) {
+	np->continue_pending = 0;
+	if (recv_buffered_len(np) > 0)
+	{
+		return 0;
+	}
+	const char* resp = "HTTP/1.1 100 Continue\r\n\r\n";
+	return send_t(np, resp, (int)strlen(resp), 0) == SOCKET_ERROR;
+}
+
+// 请求处理完之后调用：丢弃处理函数没有读取的 body，下一个请求才能从正确的位置开始解析。
+// 客户端还在等待 100 Continue 时 body 还没有发送，不再让它传输，直接关闭连接；
+// 否则在接收缓冲区中丢弃剩下的 body，不复制，剩下的超过 DISCARD_BODY_MAX_SIZE 时关闭连接而不是接收它。
+// 返回值：
+// 0 : 可以继续处理下一个请求
+// 1 : 应当关闭连接
+// 2 : 对方关闭了连接
+// -1 : 接收时出错
+static int finish_request_body(node* np) {
+	int continue_pending = np->continue_pending;
+	np->continue_pending = 0;
+	if (np->body_remaining <= 0)
+	{
+		return 0;
+	}
+	if ((continue_pending && recv_buffered_len(np) == 0) || np->body_remaining > DISCARD_BODY_MAX_SIZE)
+	{
+		LogMe.it("socket [ %p ] closes instead of receiving %lld bytes of unread body", np->socket, np->body_remaining);
+		np->body_remaining = 0;
+		return 1;
+	}
+	while (np->body_remaining > 0)
+	{
+		if (recv_buffered_len(np) == 0)
+		{
+			int r_res = fill_recv_buffer(np);
+			if (r_res <= 0)
+			{
+				return r_res == 0 ? 2 : -1;
+			}
+		}
+		int d_len = recv_buffered_len(np) < np->body_remaining ? recv_buffered_len(np) : (int)np->body_remaining;
+		np->recv_buf_start += d_len;
+		np->body_remaining -= d_len;
+	}
+	return 0;
+}
+
 int recv_t(tcp_node *np, char *buf, int len, int flags) {
-	ioctlsocket(np->socket, FIONBIO, &((u_long) {0})); // 0:blocking 1:non-blocking
-	setsockopt(np->socket, SOL_SOCKET, SO_RCVTIMEO, (char*)&((DWORD) { ((DWORD)(np->recv_timeout_s))*1000 }), sizeof(DWORD));
+	if (np->continue_pending && send_continue(np) != 0)
+	{
+		return SOCKET_ERROR;
+	}
+	// 先交出接收缓冲区里剩下的数据（MSG_PEEK 等特殊读取直接交给 recv()，此时缓冲区必须为空）
+	int buffered = recv_buffered_len(np);
+	if (buffered > 0 && len > 0)
+	{
+		int c_len = buffered < len ? buffered : len;
+		memcpy(buf, np->recv_buf + np->recv_buf_start, c_len);
+		if (!(flags & MSG_PEEK))
+		{
+			np->recv_buf_start += c_len;
+			consume_body(np, c_len);
+		}
+		return c_len;
+	}
+	apply_recv_timeout(np);
 	int r_res = recv(np->socket, buf, len, flags);
+	if (r_res > 0 && !(flags & MSG_PEEK))
+	{
+		consume_body(np, r_res);
+	}
 	if (r_res > 0)
 	{
 		// 通常会以极小的 len 调用此函数，因此为了避免打印太多的冗余日志，暂不打印成功消息
@@ -232,8 +562,7 @@ int recv_t(tcp_node *np, char *buf, int len, int flags) {
 }
 
 int send_t(tcp_node *np, const char *buf, int len, int flags) {
-	ioctlsocket(np->socket, FIONBIO, &((u_long) { 0 })); // 0:blocking 1:non-blocking
-	setsockopt(np->socket, SOL_SOCKET, SO_SNDTIMEO, (char*)&((DWORD) { ((DWORD)(np->send_timeout_s)) * 1000 }), sizeof(DWORD));
+	apply_send_timeout(np);
 	int s_res = send(np->socket, buf, len, flags);
 	if (s_res != SOCKET_ERROR)
 	{
@@ -246,23 +575,93 @@ int send_t(tcp_node *np, const char *buf, int len, int flags) {
 	return s_res;
 }
 
+// 此函数通过一次 WSASend() 调用把多个缓冲区（例如响应头和响应体）聚集发送出去，
+// 避免分两次 send() 时在 Nagle 算法下多出一个小包并触发延迟确认。
+// 若只发送了一部分（例如发送超时被打断前），则跳过已发送的部分继续发送。
+// 截止模式下 BULK 请求分块发送，每块发送后按共享的发送额度限速。
+// 成功返回发送的总字节数，失败返回 SOCKET_ERROR。
+static int send_v_t(node* np, WSABUF* bufs, DWORD buf_num) {
+	apply_send_timeout(np);
+	int total = 0;
+	while (buf_num > 0 && bufs[0].len == 0)
+	{
+		bufs++; buf_num--;
+	}
+	while (buf_num > 0)
+	{
+		DWORD sent = 0;
+		DWORD send_num = buf_num;
+		// 被截断的最后一个缓冲区原来的长度，0 表示没有截断
+		ULONG cut_len = 0;
+		unsigned long long limit = bulk_send_limit(np);
+		if (limit > 0)
+		{
+			unsigned long long sum = 0;
+			for (send_num = 0; send_num < buf_num && sum < limit; send_num++)
+			{
+				sum += bufs[send_num].len;
+			}
+			if (sum > limit)
+			{
+				cut_len = bufs[send_num - 1].len;
+				bufs[send_num - 1].len -= (ULONG)(sum - limit);
+			}
+		}
+		int s_res = WSASend(np->socket, bufs, send_num, &sent, 0, NULL, NULL);
+		if (cut_len > 0)
+		{
+			bufs[send_num - 1].len = cut_len;
+		}
+		if (s_res == SOCKET_ERROR)
+		{
+			LogMe.et("call WSASend() on socket [ %p ] with %lu buffers and return=SOCKET_ERROR <WSAGetLastError()=%d>", np->socket, send_num, WSAGetLastError());
+			return SOCKET_ERROR;
+		}
+		charge_bulk_send(np, sent);
+		total += sent;
+		while (buf_num > 0 && sent >= bufs[0].len)
+		{
+			sent -= bufs[0].len;
+			bufs++; buf_num--;
+		}
+		if (buf_num > 0)
+		{
+			bufs[0].buf += sent;
+			bufs[0].len -= sent;
+		}
+	}
+	LogMe.it("call WSASend() on socket [ %p ] and sent %d bytes in total", np->socket, total);
+	return total;
+}
+
 // 此函数先将 node 结构体中的 socket 设置为阻塞模式，然后通过 socket 传输文件。
+// 若 head 不为 NULL，则 head 会和文件的第一段数据在同一次 TransmitFile() 调用中发送出去。
+// 截止模式下 BULK 请求分块传输，每块传输后按共享的发送额度限速。
 // 成功返回 0，失败返回 non-zero。
 // 若失败，查看日志以获取详细信息。
-static int transmit_file(node* np, HANDLE hFile, unsigned long long file_size, const char* filename) {
+static int transmit_file(node* np, const char* head, DWORD head_len, HANDLE hFile, unsigned long long file_size, const char* filename) {
 	const unsigned long long max_size = 2147483646ULL;
+	TRANSMIT_FILE_BUFFERS tf_bufs = { 0 };
+	tf_bufs.Head = (LPVOID)head;
+	tf_bufs.HeadLength = head ? head_len : 0;
 	// blocking mode
-	ioctlsocket(np->socket, FIONBIO, &((u_long) { 0 })); // 0:blocking 1:non-blocking
-	while (file_size > 0ULL)
+	apply_blocking(np);
+	do
 	{
+		apply_thread_priority(np);
 		unsigned long long trans_size = file_size > max_size ? max_size : file_size;
+		unsigned long long limit = bulk_send_limit(np);
+		if (limit > 0 && trans_size > limit)
+		{
+			trans_size = limit;
+		}
 		BOOL res = TransmitFile(
 			np->socket,
 			hFile,
 			trans_size,
 			0,
 			NULL, // blocking mode
-			NULL,
+			tf_bufs.HeadLength > 0 ? &tf_bufs : NULL,
 			0
 		);
 		if (res == STATUS_DEVICE_NOT_READY)
@@ -278,13 +677,17 @@ static int transmit_file(node* np, HANDLE hFile, unsigned long long file_size, c
 				return 2;
 			//}
 		}
+		charge_bulk_send(np, trans_size + tf_bufs.HeadLength);
 		file_size -= trans_size;
-	}
+		// 响应头只随第一段数据发送
+		tf_bufs.HeadLength = 0;
+	} while (file_size > 0ULL);
 	LogMe.it("transmit_file() completed on socket [ %p ] [ file = \"%s\" ]", np->socket, filename);
 	return 0;
 }
 
-int send_text(tcp_node* np, int status_code, const char * reason_phrase, int keep_alive, const char* text_body_str_could_be_NULL, const char* MIME_type, const char *text_body_charset, int is_download, const char *download_filename) {
+// 与 send_text() 相同，header_lines 是额外的报文头字段（每行以 \r\n 结尾），可以为 NULL
+static int send_text_with_headers(tcp_node* np, int status_code, const char* reason_phrase, int keep_alive, const char* header_lines, const char* text_body_str_could_be_NULL, const char* MIME_type, const char* text_body_charset, int is_download, const char* download_filename) {
 	char resp[5000];
 	http_response(
 		resp,
@@ -292,17 +695,20 @@ int send_text(tcp_node* np, int status_code, const char * reason_phrase, int kee
 		status_code,
 		reason_phrase,
 		keep_alive,
-		NULL,
+		header_lines,
 		text_body_str_could_be_NULL ? strlen(text_body_str_could_be_NULL) : 0,
 		MIME_type,
 		text_body_charset,
 		is_download,
 		download_filename
 	);
-	if (
-		send_t(np, resp, strlen(resp), 0) == SOCKET_ERROR ||
-		( text_body_str_could_be_NULL ? (send_t(np, text_body_str_could_be_NULL, strlen(text_body_str_could_be_NULL), 0) == SOCKET_ERROR) : 0 )
-		) {
+	// 响应头和响应体一起发送
+	WSABUF bufs[2];
+	bufs[0].buf = resp;
+	bufs[0].len = (ULONG)strlen(resp);
+	bufs[1].buf = (char*)text_body_str_could_be_NULL;
+	bufs[1].len = text_body_str_could_be_NULL ? (ULONG)strlen(text_body_str_could_be_NULL) : 0;
+	if (send_v_t(np, bufs, text_body_str_could_be_NULL ? 2 : 1) == SOCKET_ERROR) {
 		return -1;
 	}
 	else {
@@ -310,6 +716,10 @@ int send_text(tcp_node* np, int status_code, const char * reason_phrase, int kee
 	}
 }
 
+int send_text(tcp_node* np, int status_code, const char * reason_phrase, int keep_alive, const char* text_body_str_could_be_NULL, const char* MIME_type, const char *text_body_charset, int is_download, const char *download_filename) {
+	return send_text_with_headers(np, status_code, reason_phrase, keep_alive, NULL, text_body_str_could_be_NULL, MIME_type, text_body_charset, is_download, download_filename);
+}
+
 int send_file(tcp_node* np, const char* filename, int keep_alive, const char* MIME_type, const char* file_charset, int is_download, const char* download_filename
 	, const char* phrase_200
 	, const char* html_200
@@ -319,7 +729,7 @@ int send_file(tcp_node* np, const char* filename, int keep_alive, const char* MI
 	, const char* html_500
 ) {
 	char resp[5000];
-	HANDLE hFile = get_file_hd(filename, 1).handle;
+	HANDLE hFile = get_file_hd(filename, 1, 0).handle;
 	if (hFile == NULL) {
 		LogMe.et("send_file() [socket = %p ] [file = \"%s\" ] could not get file handle", np->socket, filename);
 		return send_text(
@@ -362,10 +772,8 @@ int send_file(tcp_node* np, const char* filename, int keep_alive, const char* MI
 				is_download,
 				download_filename
 			);
-			if (
-				send_t(np, resp, strlen(resp), 0) == SOCKET_ERROR ||
-				transmit_file(np, hFile, fSize.QuadPart, filename) != 0
-				) {
+			// 响应头随文件的第一段数据一起发送
+			if (transmit_file(np, resp, (DWORD)strlen(resp), hFile, fSize.QuadPart, filename) != 0) {
 				CloseHandle(hFile); hFile = NULL;
 				return -1;
 			}
@@ -377,47 +785,353 @@ int send_file(tcp_node* np, const char* filename, int keep_alive, const char* MI
 	}
 }
 
-int receive_file(tcp_node* np, const char* file_dir, const char* filename, int keep_alive, long long file_size
+// 文件缓存：开考时所有座位几乎同时下载同一份试卷，缓存命中时直接从内存发送，不再打开文件、查询文件大小
+// 缓存按文件路径索引，按 LRU 淘汰，总大小不超过 FILE_CACHE_CAPACITY
+// 每个缓存项最多每隔 FILE_CACHE_REVALIDATE_MS 毫秒检查一次文件的修改时间和大小（不打开文件），发生变化则失效并重新加载
+enum file_cache_state { FILE_CACHE_LOADING = 0, FILE_CACHE_READY, FILE_CACHE_FAILED };
+
+typedef struct file_cache_entry {
+	struct file_cache_entry* prev;
+	struct file_cache_entry* next;
+	char* filename;
+	char16_t* wide_filename;
+	char* data;
+	unsigned long long size;
+	FILETIME mtime;
+	ULONGLONG checked_tick;
+	// 以下字段受 file_cache_lock 保护
+	long refs;
+	int state;
+	int detached;
+} file_cache_entry;
+
+static SRWLOCK file_cache_lock = SRWLOCK_INIT;
+// 等待其它线程加载同一个文件
+static CONDITION_VARIABLE file_cache_cv = CONDITION_VARIABLE_INIT;
+// 链表头是最近使用的，链表尾是最久未使用的
+static file_cache_entry* file_cache_head = NULL;
+static file_cache_entry* file_cache_tail = NULL;
+static unsigned long long file_cache_bytes = 0ULL;
+
+static void file_cache_free(file_cache_entry* e) {
+	free(e->filename);
+	free(e->wide_filename);
+	free(e->data);
+	free(e);
+}
+
+// 以下 file_cache_* 函数（file_cache_load() 除外）都必须在持有 file_cache_lock 时调用
+
+static void file_cache_unlink(file_cache_entry* e) {
+	if (e->detached)
+	{
+		return;
+	}
+	if (e->prev) e->prev->next = e->next; else file_cache_head = e->next;
+	if (e->next) e->next->prev = e->prev; else file_cache_tail = e->prev;
+	e->prev = e->next = NULL;
+	e->detached = 1;
+	if (e->state == FILE_CACHE_READY)
+	{
+		file_cache_bytes -= e->size;
+	}
+}
+
+static void file_cache_push_front(file_cache_entry* e) {
+	e->prev = NULL;
+	e->next = file_cache_head;
+	if (file_cache_head) file_cache_head->prev = e; else file_cache_tail = e;
+	file_cache_head = e;
+}
+
+// 归还一个引用，已被移出缓存且没有引用的缓存项在这里释放
+static void file_cache_put(file_cache_entry* e) {
+	if (--e->refs == 0 && e->detached)
+	{
+		file_cache_free(e);
+	}
+}
+
+// 从最久未使用的一端开始淘汰，直到总大小不超过容量；正在被发送的缓存项移出缓存后，由最后一个使用者释放
+static void file_cache_evict() {
+	file_cache_entry* e = file_cache_tail;
+	while (file_cache_bytes > FILE_CACHE_CAPACITY && e != NULL)
+	{
+		file_cache_entry* prev = e->prev;
+		if (e->state == FILE_CACHE_READY)
+		{
+			LogMe.it("file cache: evict [ \"%s\" ] <Size: %llu>", e->filename, e->size);
+			file_cache_unlink(e);
+			if (e->refs == 0)
+			{
+				file_cache_free(e);
+			}
+		}
+		e = prev;
+	}
+}
+
+// 把文件整个读入内存，成功返回 0，失败（包括文件过大不适合缓存）返回 non-zero
+// 不持有 file_cache_lock 时调用，其它线程在条件变量上等待加载结果
+static int file_cache_load(file_cache_entry* e) {
+	ULONGLONG start_tick = GetTickCount64();
+	HANDLE hFile = get_file_hd(e->filename, 1, 0).handle;
+	if (hFile == NULL)
+	{
+		return 1;
+	}
+	int res = 0;
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle(hFile, &info))
+	{
+		LogMe.et("file cache: could not get the information of file [ \"%s\" ] due to error: %lu", e->filename, GetLastError());
+		res = 2; goto clean;
+	}
+	e->size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	e->mtime = info.ftLastWriteTime;
+	if (e->size > FILE_CACHE_MAX_FILE_SIZE || e->size > FILE_CACHE_CAPACITY)
+	{
+		LogMe.wt("file cache: file [ \"%s\" ] <Size: %llu> is too large to be cached", e->filename, e->size);
+		res = 3; goto clean;
+	}
+	e->data = malloc(e->size > 0 ? e->size : 1);
+	if (e->data == NULL)
+	{
+		LogMe.et("file cache: could not load file [ \"%s\" ] <Size: %llu> due to error: Malloc Fail", e->filename, e->size);
+		res = 4; goto clean;
+	}
+	unsigned long long loaded = 0ULL;
+	while (loaded < e->size)
+	{
+		DWORD want = e->size - loaded > 0x40000000ULL ? 0x40000000UL : (DWORD)(e->size - loaded);
+		DWORD got = 0;
+		if (!ReadFile(hFile, e->data + loaded, want, &got, NULL) || got == 0)
+		{
+			LogMe.et("file cache: could not read file [ \"%s\" ] due to error: %lu", e->filename, GetLastError());
+			res = 5; goto clean;
+		}
+		loaded += got;
+	}
+	LogMe.it("file cache: loaded [ \"%s\" ] <Size: %llu> in %llu ms", e->filename, e->size, GetTickCount64() - start_tick);
+clean:
+	CloseHandle(hFile); hFile = NULL;
+	return res;
+}
+
+// 获取文件对应的缓存项，未命中时加载文件；返回 NULL 表示文件无法缓存
+// 返回的缓存项持有一个引用，用完后必须在持有 file_cache_lock 时调用 file_cache_put()
+static file_cache_entry* file_cache_get(const char* filename) {
+	AcquireSRWLockExclusive(&file_cache_lock);
+	file_cache_entry* e = file_cache_head;
+	while (e != NULL && strcmp(e->filename, filename) != 0)
+	{
+		e = e->next;
+	}
+	if (e != NULL && e->state == FILE_CACHE_READY && GetTickCount64() - e->checked_tick >= FILE_CACHE_REVALIDATE_MS)
+	{
+		e->checked_tick = GetTickCount64();
+		WIN32_FILE_ATTRIBUTE_DATA fad;
+		if (
+			!GetFileAttributesExW(e->wide_filename, GetFileExInfoStandard, &fad) ||
+			CompareFileTime(&fad.ftLastWriteTime, &e->mtime) != 0 ||
+			(((unsigned long long)fad.nFileSizeHigh << 32) | fad.nFileSizeLow) != e->size
+			)
+		{
+			LogMe.it("file cache: [ \"%s\" ] changed on disk, invalidated", e->filename);
+			file_cache_unlink(e);
+			if (e->refs == 0)
+			{
+				file_cache_free(e);
+			}
+			e = NULL;
+		}
+	}
+	if (e == NULL)
+	{
+		// 未命中：先放入一个加载中的缓存项，同一时刻请求同一文件的其它线程等待它，而不是各自重复读取文件
+		e = zero_malloc(sizeof(file_cache_entry));
+		if (e == NULL || (e->filename = substr(filename, NULL)) == NULL || (e->wide_filename = get_wide_path(filename)) == NULL)
+		{
+			LogMe.et("file cache: could not cache file [ \"%s\" ] due to error: Malloc Fail", filename);
+			if (e != NULL)
+			{
+				file_cache_free(e); e = NULL;
+			}
+			ReleaseSRWLockExclusive(&file_cache_lock);
+			return NULL;
+		}
+		e->refs = 1;
+		e->state = FILE_CACHE_LOADING;
+		file_cache_push_front(e);
+		ReleaseSRWLockExclusive(&file_cache_lock);
+		int load_res = file_cache_load(e);
+		AcquireSRWLockExclusive(&file_cache_lock);
+		if (load_res == 0)
+		{
+			e->state = FILE_CACHE_READY;
+			e->checked_tick = GetTickCount64();
+			file_cache_bytes += e->size;
+			file_cache_evict();
+		}
+		else
+		{
+			file_cache_unlink(e);
+			e->state = FILE_CACHE_FAILED;
+			file_cache_put(e); e = NULL;
+		}
+		WakeAllConditionVariable(&file_cache_cv);
+		ReleaseSRWLockExclusive(&file_cache_lock);
+		return e;
+	}
+	e->refs++;
+	while (e->state == FILE_CACHE_LOADING)
+	{
+		SleepConditionVariableSRW(&file_cache_cv, &file_cache_lock, INFINITE, 0);
+	}
+	if (e->state != FILE_CACHE_READY)
+	{
+		file_cache_put(e); e = NULL;
+	}
+	else if (!e->detached && e != file_cache_head)
+	{
+		// 移到链表头，标记为最近使用
+		e->prev->next = e->next;
+		if (e->next) e->next->prev = e->prev; else file_cache_tail = e->prev;
+		file_cache_push_front(e);
+	}
+	ReleaseSRWLockExclusive(&file_cache_lock);
+	return e;
+}
+
+int preload_cached_file(const char* filename, unsigned long long* size_p) {
+	file_cache_entry* e = file_cache_get(filename);
+	if (e == NULL)
+	{
+		return -1;
+	}
+	AcquireSRWLockExclusive(&file_cache_lock);
+	if (size_p)
+	{
+		*size_p = e->size;
+	}
+	file_cache_put(e); e = NULL;
+	ReleaseSRWLockExclusive(&file_cache_lock);
+	return 0;
+}
+
+int send_cached_file(tcp_node* np, const char* filename, int keep_alive, const char* MIME_type, const char* file_charset, int is_download, const char* download_filename
 	, const char* phrase_200
 	, const char* html_200
+	, const char* phrase_404
+	, const char* html_404
 	, const char* phrase_500
 	, const char* html_500
 ) {
+	file_cache_entry* e = file_cache_get(filename);
+	if (e == NULL)
+	{
+		// 文件不存在、过大或读取失败，交给 send_file() 从磁盘发送或回复 404/500 页面
+		return send_file(np, filename, keep_alive, MIME_type, file_charset, is_download, download_filename, phrase_200, html_200, phrase_404, html_404, phrase_500, html_500);
+	}
+	LogMe.it("sending cached file [ \"%s\" ] <Size: %llu> to socket [ %p ] ...", filename, e->size, np->socket);
+	char resp[5000];
+	http_response(
+		resp,
+		sizeof(resp),
+		200,
+		phrase_200,
+		keep_alive,
+		NULL,
+		e->size,
+		MIME_type,
+		file_charset,
+		is_download,
+		download_filename
+	);
+	// 响应头和文件内容一起发送
+	WSABUF bufs[2];
+	bufs[0].buf = resp;
+	bufs[0].len = (ULONG)strlen(resp);
+	bufs[1].buf = e->data;
+	bufs[1].len = (ULONG)e->size;
+	int return_value = send_v_t(np, bufs, 2) == SOCKET_ERROR ? -1 : 0;
+	AcquireSRWLockExclusive(&file_cache_lock);
+	file_cache_put(e); e = NULL;
+	ReleaseSRWLockExclusive(&file_cache_lock);
+	return return_value;
+}
+
+// 等待异步写操作完成，写入的字节数与 len 相同时返回非零
+static int finish_file_write(HANDLE hFile, OVERLAPPED* ov, DWORD len, int* pending) {
+	DWORD written = 0;
+	BOOL res = GetOverlappedResult(hFile, ov, &written, TRUE);
+	*pending = 0;
+	return res && written == len;
+}
+
+// 把接收完毕的临时文件原子地改名为最终文件名（已存在则替换），成功返回非零
+static int rename_received_file(const char* temp_path, const char* final_path) {
+	char16_t* w_temp = get_wide_path(temp_path);
+	char16_t* w_final = get_wide_path(final_path);
+	BOOL res = w_temp && w_final && MoveFileExW(w_temp, w_final, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	if (!res)
+	{
+		LogMe.et("Rename file [ %s ] to [ %s ] failed with error: %lu", temp_path, final_path, (w_temp && w_final) ? GetLastError() : ERROR_NOT_ENOUGH_MEMORY);
+	}
+	free(w_temp); w_temp = NULL;
+	free(w_final); w_final = NULL;
+	return res;
+}
+
+// 删除没有接收完毕的临时文件
+static void delete_received_file(const char* temp_path) {
+	char16_t* w_temp = get_wide_path(temp_path);
+	if (!w_temp || !DeleteFileW(w_temp))
+	{
+		LogMe.et("Delete file [ %s ] failed with error: %lu", temp_path, w_temp ? GetLastError() : ERROR_NOT_ENOUGH_MEMORY);
+	}
+	free(w_temp); w_temp = NULL;
+}
+
+// 获取临时文件中已经收到的字节数，临时文件不存在时返回 -1
+// 预分配不改变文件大小，而同一时刻最多只有一个按顺序的写操作，所以文件大小就是已经连续写入的字节数
+static long long get_received_size(const char* temp_path) {
+	char16_t* w_temp = get_wide_path(temp_path);
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	long long size = -1;
+	if (w_temp && GetFileAttributesExW(w_temp, GetFileExInfoStandard, &attr))
+	{
+		size = ((long long)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+	}
+	free(w_temp); w_temp = NULL;
+	return size;
+}
+
+// 检查 file_dir 和 filename 并拼接出最终文件路径和临时文件路径，成功返回非零，两个路径需要调用者释放
+static int get_received_file_paths(const char* file_dir, const char* filename, char** combined_path_p, char** temp_path_p) {
 	size_t fdstrlen = strlen(file_dir);
 	size_t fnstrlen = strlen(filename);
+	*combined_path_p = NULL;
+	*temp_path_p = NULL;
 	if (fdstrlen <= 0 || fnstrlen <= 0)
 	{
-		handle_open_fail:
-		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] could not get file handle", np->socket, filename);
-		handle_500:
-		return send_text(
-			np,
-			500,
-			phrase_500,
-			keep_alive,
-			html_500,
-			MIME_TYPE_HTML,
-			HTTP_CHARSET_UTF8,
-			0, NULL
-		) == 0 ? 1 : -1;
-	}
-	if (file_size <= 0)
-	{
-		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] file_size = %lld , error!", np->socket, filename, file_size);
-		goto handle_500;
+		return 0;
 	}
 	if (file_dir[fdstrlen-1] != '\\' || filename[0] == '\\' || filename[0] == '/')
 	{
-		goto handle_open_fail;
+		return 0;
 	}
 	if (str_contain_relative_path(file_dir) || str_contain_relative_path(filename))
 	{
-		goto handle_open_fail;
+		return 0;
 	}
 	char* combined_path = zero_malloc(fdstrlen+fnstrlen+1);
-	if (!combined_path)
+	char* temp_path = zero_malloc(fdstrlen+fnstrlen+strlen(RECEIVE_FILE_TEMP_SUFFIX)+1);
+	if (!combined_path || !temp_path)
 	{
-		goto handle_open_fail;
+		free(combined_path); combined_path = NULL;
+		free(temp_path); temp_path = NULL;
+		return 0;
 	}
 #ifdef V_WINDOWS
 	/* system() may be unstable sometimes */
@@ -437,47 +1151,323 @@ int receive_file(tcp_node* np, const char* file_dir, const char* filename, int k
 #endif // V_WINDOWS
 	strcat(combined_path, file_dir);
 	strcat(combined_path, filename);
-	HANDLE hFile = get_file_hd(combined_path, 0).handle;
+	// 先写入临时文件，接收完毕后再改名为最终文件名，接收到一半的文件不会以最终文件名出现
+	strcat(temp_path, combined_path);
+	strcat(temp_path, RECEIVE_FILE_TEMP_SUFFIX);
+	*combined_path_p = combined_path;
+	*temp_path_p = temp_path;
+	return 1;
+}
+
+// 回复一个没有 body 的报文，报文头中带有 Upload-Offset 字段，返回值与 send_text() 相同
+static int send_upload_offset(node* np, int status_code, const char* reason_phrase, int keep_alive, long long offset) {
+	char offset_line[100];
+	snprintf(offset_line, sizeof(offset_line), UPLOAD_OFFSET_HEADER ": %lld\r\n", offset);
+	return send_text_with_headers(np, status_code, reason_phrase, keep_alive, offset_line, NULL, NULL, NULL, 0, NULL);
+}
+
+// 计算临时文件前 len 个字节的 SHA-256（续传时，之前的连接收到的部分），buf 是大小为 buf_len 的缓冲区，成功返回非零
+static int hash_received_prefix(const char* temp_path, long long len, vsha256* sha, char* buf, DWORD buf_len) {
+	HANDLE hFile = get_file_hd(temp_path, 1, 0).handle;
+	if (hFile == NULL)
+	{
+		return 0;
+	}
+	int res = 1;
+	while (len > 0)
+	{
+		DWORD read_len = 0;
+		if (!ReadFile(hFile, buf, len > buf_len ? buf_len : (DWORD)len, &read_len, NULL) || read_len == 0)
+		{
+			res = 0;
+			break;
+		}
+		vsha256_update(sha, buf, read_len);
+		len -= read_len;
+	}
+	CloseHandle(hFile); hFile = NULL;
+	return res;
+}
+
+// 把文件的 SHA-256 以 sha256sum 的格式写入 final_path.sha256，与提交的文件保存在一起，成功返回非零
+static int save_received_digest(const char* final_path, const char* filename, const char* hex) {
+	char* digest_path = zero_malloc(strlen(final_path) + strlen(RECEIVE_FILE_DIGEST_SUFFIX) + 1);
+	if (!digest_path)
+	{
+		return 0;
+	}
+	strcat(digest_path, final_path);
+	strcat(digest_path, RECEIVE_FILE_DIGEST_SUFFIX);
+	HANDLE hFile = get_file_hd(digest_path, 0, 0).handle;
+	free(digest_path); digest_path = NULL;
+	if (hFile == NULL)
+	{
+		return 0;
+	}
+	char line[VSHA256_HEX_SIZE + 1100];
+	int line_len = snprintf(line, sizeof(line), "%s  %s\n", hex, filename);
+	DWORD written = 0;
+	int res = line_len > 0 && line_len < (int)sizeof(line) && WriteFile(hFile, line, (DWORD)line_len, &written, NULL) && written == (DWORD)line_len;
+	CloseHandle(hFile); hFile = NULL;
+	return res;
+}
+
+int send_received_file_offset(tcp_node* np, const char* file_dir, const char* filename, int keep_alive
+	, const char* phrase_200
+	, const char* phrase_404
+) {
+	char* combined_path = NULL;
+	char* temp_path = NULL;
+	long long offset = -1;
+	if (get_received_file_paths(file_dir, filename, &combined_path, &temp_path))
+	{
+		offset = get_received_size(temp_path);
+	}
 	free(combined_path); combined_path = NULL;
+	free(temp_path); temp_path = NULL;
+	if (offset < 0)
+	{
+		LogMe.it("send_received_file_offset() [socket = %p ] [file = \"%s\" ] nothing to resume", np->socket, filename);
+		return send_text(np, 404, phrase_404, keep_alive, NULL, NULL, NULL, 0, NULL) == 0 ? 1 : -1;
+	}
+	LogMe.it("send_received_file_offset() [socket = %p ] [file = \"%s\" ] %lld bytes received", np->socket, filename, offset);
+	return send_upload_offset(np, 200, phrase_200, keep_alive, offset) == 0 ? 0 : -1;
+}
+
+int receive_file(tcp_node* np, const char* file_dir, const char* filename, int keep_alive, long long file_size, long long file_offset, const char* expected_sha256
+	, const char* phrase_200
+	, const char* html_200
+	, const char* phrase_500
+	, const char* html_500
+) {
+	char* combined_path = NULL;
+	char* temp_path = NULL;
+	if (!get_received_file_paths(file_dir, filename, &combined_path, &temp_path))
+	{
+		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] could not get file handle", np->socket, filename);
+		handle_500:
+		free(combined_path); combined_path = NULL;
+		free(temp_path); temp_path = NULL;
+		return send_text(
+			np,
+			500,
+			phrase_500,
+			keep_alive,
+			html_500,
+			MIME_TYPE_HTML,
+			HTTP_CHARSET_UTF8,
+			0, NULL
+		) == 0 ? 1 : -1;
+	}
+	// 续传时 body 可以为空：文件已经全部收到，只是客户端没有收到 200
+	if (file_size < 0 || file_offset < 0 || (file_size == 0 && file_offset == 0))
+	{
+		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] file_size = %lld , file_offset = %lld , error!", np->socket, filename, file_size, file_offset);
+		goto handle_500;
+	}
+	if (file_offset > 0)
+	{
+		// 续传：临时文件中的数据必须不少于客户端给出的偏移，否则告诉客户端实际收到了多少
+		long long received = get_received_size(temp_path);
+		if (received < file_offset)
+		{
+			LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] file_offset = %lld but %lld bytes received", np->socket, filename, file_offset, received);
+			free(combined_path); combined_path = NULL;
+			free(temp_path); temp_path = NULL;
+			// body 没有被读取，回复后必须关闭连接
+			return send_upload_offset(np, 409, "Conflict", 0, received > 0 ? received : 0) == 0 ? 2 : -1;
+		}
+	}
+	// 双缓冲：一个缓冲区交给异步 WriteFile() 写入磁盘的同时，用另一个缓冲区接收网络数据；
+	// 同一时刻最多只有一个写操作未完成，磁盘跟不上时，接收下一块数据之前先等待上一次写入完成（反压）
+	char* bufs = malloc(2 * RECEIVE_FILE_BUFFER_SIZE);
+	OVERLAPPED ov = { 0 };
+	ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!bufs || !ov.hEvent)
+	{
+		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] could not prepare the buffers", np->socket, filename);
+		free(bufs); bufs = NULL;
+		if (ov.hEvent)
+		{
+			CloseHandle(ov.hEvent); ov.hEvent = NULL;
+		}
+		goto handle_500;
+	}
+	// 文件内容的 SHA-256 在接收的同时计算，不需要事后再读一遍文件；只有续传时才需要读出之前收到的部分
+	vsha256 sha;
+	vsha256_init(&sha);
+	HANDLE hFile = NULL;
+	if (file_offset > 0 && !hash_received_prefix(temp_path, file_offset, &sha, bufs, 2 * RECEIVE_FILE_BUFFER_SIZE))
+	{
+		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] could not read the first %lld bytes received with error %lu", np->socket, filename, file_offset, GetLastError());
+		goto fail_before_receiving;
+	}
+	hFile = get_file_hd(temp_path, 0, FILE_HD_OVERLAPPED | (file_offset > 0 ? FILE_HD_KEEP_CONTENT : 0)).handle;
 	if (hFile == NULL) {
-		goto handle_open_fail;
+		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] could not get file handle", np->socket, filename);
+		goto fail_before_receiving;
+	}
+	if (file_offset > 0)
+	{
+		// 偏移之后多出的数据丢弃，由这次请求重新写入
+		FILE_END_OF_FILE_INFO eof_info;
+		eof_info.EndOfFile.QuadPart = file_offset;
+		if (!SetFileInformationByHandle(hFile, FileEndOfFileInfo, &eof_info, sizeof(eof_info)))
+		{
+			LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] could not truncate to %lld bytes with error %lu", np->socket, filename, file_offset, GetLastError());
+			goto fail_before_receiving;
+		}
 	}
-	for (long long i = 0; i < file_size;) {
-		char x[512000];
-		long long rlen = file_size - i > sizeof(x) ? sizeof(x) : file_size - i;
+	// 按整个文件的大小预先分配磁盘空间，写入时文件不必一次次扩展，也更不容易产生碎片；预分配不改变文件大小
+	FILE_ALLOCATION_INFO alloc_info;
+	alloc_info.AllocationSize.QuadPart = file_offset + file_size;
+	if (!SetFileInformationByHandle(hFile, FileAllocationInfo, &alloc_info, sizeof(alloc_info)))
+	{
+		LogMe.wt("receive_file() [socket = %p ] [file = \"%s\" ] could not preallocate %lld bytes with error %lu", np->socket, filename, file_offset + file_size, GetLastError());
+	}
+	int pending = 0;
+	DWORD pending_len = 0;
+	int cur = 0;
+	int return_value = 0;
+	// 连接中断时已经收到但还没有写入的数据
+	char* unwritten_buf = NULL;
+	long long unwritten = 0;
+	long long i = 0;
+	char hex[VSHA256_HEX_SIZE] = { 0 };
+	while (i < file_size) {
+		char* x = bufs + cur * RECEIVE_FILE_BUFFER_SIZE;
+		long long rlen = file_size - i > RECEIVE_FILE_BUFFER_SIZE ? RECEIVE_FILE_BUFFER_SIZE : file_size - i;
 		long long rtotal = 0;
 		while (rtotal < rlen)
 		{
 			int rres = recv_t(np, x+rtotal, rlen - rtotal, 0);
 			if (rres <= 0)
 			{
-				CloseHandle(hFile); hFile = NULL;
-				return -1;
+				unwritten_buf = x;
+				unwritten = rtotal;
+				return_value = -1; goto clean;
 			}
 			rtotal += rres;
 		}
-		long long bWritten = 0;
-		BOOL wres = WriteFile(hFile, &x, rlen, &bWritten, NULL);
-		if (!wres || bWritten < rlen) {
-			LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] failed to write to file with error %lu", np->socket, filename, GetLastError());
-			CloseHandle(hFile); hFile = NULL;
-			goto handle_500;
+		if (pending && !finish_file_write(hFile, &ov, pending_len, &pending))
+		{
+			goto write_fail;
+		}
+		ov.Offset = (DWORD)(file_offset + i);
+		ov.OffsetHigh = (DWORD)((unsigned long long)(file_offset + i) >> 32);
+		ResetEvent(ov.hEvent);
+		if (!WriteFile(hFile, x, (DWORD)rlen, NULL, &ov) && GetLastError() != ERROR_IO_PENDING) {
+			goto write_fail;
 		}
+		pending = 1;
+		pending_len = (DWORD)rlen;
+		// 磁盘写入这块数据的同时计算它的哈希，两者都只读缓冲区
+		vsha256_update(&sha, x, (size_t)rlen);
 		//LogMe.bt("successfully write %lld bytes to file[ \"%s\" ]", rlen, filename);
 		i += rlen;
+		cur ^= 1;
 	}
+	if (pending && !finish_file_write(hFile, &ov, pending_len, &pending))
+	{
+		goto write_fail;
+	}
+	unsigned char digest[VSHA256_DIGEST_SIZE];
+	vsha256_final(&sha, digest);
+	vsha256_hex(digest, hex);
+	if (expected_sha256 && !vsha256_hex_equal(digest, expected_sha256, strlen(expected_sha256)))
+	{
+		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] SHA-256 mismatch, expected %s , received %s", np->socket, filename, expected_sha256, hex);
+		return_value = 3;
+	}
+	goto clean;
+write_fail:
+	LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] failed to write to file with error %lu", np->socket, filename, GetLastError());
+	return_value = 1;
+clean:
+	if (pending)
+	{
+		// 缓冲区释放之前必须等待未完成的写操作结束；连接中断时让它写完，续传时客户端可以少发一些数据
+		if (return_value > 0)
+		{
+			CancelIoEx(hFile, &ov);
+		}
+		if (!finish_file_write(hFile, &ov, pending_len, &pending))
+		{
+			unwritten = 0;
+		}
+	}
+	if (unwritten > 0)
+	{
+		// 连接中断前收到的最后一部分数据也写入临时文件，紧接在已写入的数据之后
+		ov.Offset = (DWORD)(file_offset + i);
+		ov.OffsetHigh = (DWORD)((unsigned long long)(file_offset + i) >> 32);
+		ResetEvent(ov.hEvent);
+		if (WriteFile(hFile, unwritten_buf, (DWORD)unwritten, NULL, &ov) || GetLastError() == ERROR_IO_PENDING)
+		{
+			pending = 1;
+			finish_file_write(hFile, &ov, (DWORD)unwritten, &pending);
+		}
+	}
+	CloseHandle(ov.hEvent); ov.hEvent = NULL;
+	free(bufs); bufs = NULL;
 	CloseHandle(hFile); hFile = NULL;
-	LogMe.it("receive_file() [socket = %p ] [file = \"%s\" ] completed with file_size = %lld", np->socket, filename, file_size);
-	return send_text(
+	// 哈希先于文件保存，文件以最终文件名出现时哈希已经在旁边了
+	if (return_value == 0 && !save_received_digest(combined_path, filename, hex))
+	{
+		LogMe.et("receive_file() [socket = %p ] [file = \"%s\" ] could not save the SHA-256 with error %lu", np->socket, filename, GetLastError());
+		return_value = 1;
+	}
+	if (return_value == 0 && !rename_received_file(temp_path, combined_path))
+	{
+		return_value = 1;
+	}
+	if (return_value > 0)
+	{
+		// 写入失败或哈希不一致时临时文件的内容不可信，删除；连接中断时保留，客户端可以续传
+		delete_received_file(temp_path);
+	}
+	else if (return_value < 0)
+	{
+		LogMe.it("receive_file() [socket = %p ] [file = \"%s\" ] interrupted, \"%s\" is kept for resuming", np->socket, filename, temp_path);
+	}
+	free(combined_path); combined_path = NULL;
+	free(temp_path); temp_path = NULL;
+	if (return_value < 0)
+	{
+		return return_value;
+	}
+	char digest_line[VSHA256_HEX_SIZE + 100];
+	snprintf(digest_line, sizeof(digest_line), HTTP_HEADER_CONTENT_SHA256 ": %s\r\n", hex);
+	if (return_value == 3)
+	{
+		// 回复服务器收到的数据的哈希，body 已经全部读取，连接可以继续使用
+		return send_text_with_headers(np, 400, "Bad Request", keep_alive, digest_line, NULL, NULL, NULL, 0, NULL) == 0 ? 3 : -1;
+	}
+	else if (return_value > 0)
+	{
+		goto handle_500;
+	}
+	LogMe.it("receive_file() [socket = %p ] [file = \"%s\" ] completed with file_size = %lld , SHA-256 = %s", np->socket, filename, file_offset + file_size, hex);
+	return send_text_with_headers(
 		np,
 		200,
 		phrase_200,
 		keep_alive,
+		digest_line,
 		html_200,
 		MIME_TYPE_HTML,
 		HTTP_CHARSET_UTF8,
 		0, NULL
 	) == 0 ? 0 : -1;
+
+fail_before_receiving:
+	if (hFile)
+	{
+		CloseHandle(hFile); hFile = NULL;
+	}
+	CloseHandle(ov.hEvent); ov.hEvent = NULL;
+	free(bufs); bufs = NULL;
+	goto handle_500;
 }
 
 typedef struct generator_params {
@@ -485,37 +1475,63 @@ typedef struct generator_params {
 	int recv_t_return_val;
 } generator_params;
 
-static char generator(void* params_p, int* continue_flag_p) {
-	generator_params* gpp = params_p;
+// 把接收缓冲区中的数据直接喂给连接的流式解析器，数据不够时才调用一次 recv()，直到取出一个报文头。
+// 取出的报文视图指向接收缓冲区，在下一次调用此函数之前有效；报文头之后的数据（body 或流水线中的下一个请求）留在接收缓冲区中。
+// 返回值：
+// 0 : 取出了一个报文，*hmsg_pp 指向报文视图，需要检查 success 字段
+// -2 : 无法创建解析器
+// -3 : recv() 失败或对方关闭了连接，recv() 的返回值存放在 gpp->recv_t_return_val 中
+static int next_parsed_http_message(generator_params* gpp, const HttpMessageView** hmsg_pp) {
 	node* np = gpp->np;
-	char buf[1];
-	gpp->recv_t_return_val = recv_t(np, buf, sizeof(buf), 0);
-	*continue_flag_p = (gpp->recv_t_return_val == sizeof(buf));
-	return buf[0];
+	if (!np->http_parser)
+	{
+		np->http_parser = new_http_view_parser(0);
+		if (!np->http_parser)
+		{
+			return -2;
+		}
+	}
+	while (1)
+	{
+		if (recv_buffered_len(np) > 0)
+		{
+			size_t consumed = 0;
+			int f_res = feed_http_view_parser(np->http_parser, np->recv_buf + np->recv_buf_start, recv_buffered_len(np), &consumed);
+			if (f_res)
+			{
+				np->recv_buf_start += (int)consumed;
+				*hmsg_pp = take_http_message_view(np->http_parser);
+				return 0;
+			}
+		}
+		gpp->recv_t_return_val = fill_recv_buffer(np);
+		if (gpp->recv_t_return_val <= 0)
+		{
+			return -3;
+		}
+	}
 }
 
-static int printHttpHeader(vlist this_vlist, long i, void* extra) {
-	const HttpHeader* header = this_vlist->get_const(this_vlist, i);
-	LogMe.n("%s: %s", header->field, header->value);
-	return 0; // go on
+static void printHttpSliceKVs(const HttpSliceKV* kvs, int num) {
+	for (int i = 0; i < num; i++)
+	{
+		LogMe.n("%.*s: %.*s", (int)kvs[i].field.len, kvs[i].field.at, (int)kvs[i].value.len, kvs[i].value.at);
+	}
 }
 
-typedef struct max_contains {
-	size_t pattern_str_len;
-	long index;
-	const char* path;
-} max_contains;
-
-static int testPattern(vlist this_vlist, long i, void* extra) {
-	max_contains* mp = extra;
+// 把 HttpHandler 添加到路由表中，extra 是路由表
+// return non-zero to break
+static int add_route(vlist this_vlist, long i, void* extra) {
+	HttpRouter* router = extra;
 	HttpHandler* hhandler = this_vlist->get(this_vlist, i);
-	if (hhandler->path_contains && strlen(hhandler->path_contains)>0 && strstr(mp->path, hhandler->path_contains) == mp->path) // "starts with"
+	HttpMethod method = hhandler->method_only ? hhandler->method : INVALID_METHOD;
+	if (hhandler->path_contains && strlen(hhandler->path_contains) > 0 && http_router_add(router, hhandler->path_contains, HTTP_ROUTE_PREFIX, method, hhandler) == -2)
 	{
-		size_t pattern_str_len = strlen(hhandler->path_contains);
-		if (mp->index < 0 || pattern_str_len >= mp->pattern_str_len)
-		{
-			mp->index = i; mp->pattern_str_len = pattern_str_len;
-		}
+		return 1;
+	}
+	if (hhandler->path_exact && strlen(hhandler->path_exact) > 0 && http_router_add(router, hhandler->path_exact, HTTP_ROUTE_EXACT, method, hhandler) == -2)
+	{
+		return 1;
 	}
 	return 0; // go on
 }
@@ -524,30 +1540,35 @@ static DWORD WINAPI connection_run(_In_ LPVOID params_p) {
 	params* pp = params_p;
 	node* np = pp->node_p;
 	generator_params gp = { .np = np };
-	vlist http_handlers = pp->http_handlers;
+	const HttpRouter* router = pp->router;
+
+	np->arena = make_varena(REQUEST_ARENA_BLOCK_SIZE);
+	if (!np->arena)
+	{
+		LogMe.et("socket [ %p ] request arena Malloc failed", np->socket);
+		return error_shutdown(np, params_p, 6);
+	}
 
 	while (1)
 	{
-		char* message = NULL;
-		HttpMethod method = INVALID_METHOD;
-		int nres = next_http_message(&method, &message, generator, &gp, 0);
-		LogMe.et("[ HTTP next_http_message() Res From Socket %p ] %d", np->socket, nres);
+		// 上一个请求分配的内存一次性回收
+		varena_reset(np->arena);
+		const HttpMessageView* hmsg = NULL;
+		int nres = next_parsed_http_message(&gp, &hmsg);
+		LogMe.et("[ HTTP next_parsed_http_message() Res From Socket %p ] %d", np->socket, nres);
 		if (nres >= 0)
 		{
-			LogMe.it("[ HTTP Message From Socket %p ] %s", np->socket, message);
-			HttpMessage hmsg = parse_http_message(message, 0);
-			if (!(hmsg.malloc_success))
+			if (!(hmsg->success))
 			{
-				LogMe.et("[ Parsed HTTP Message From Socket %p ] <Malloc Fail>", np->socket);
-				freeHttpMessage(&hmsg);
-				// response 500 then go on
+				LogMe.et("[ Parsed HTTP Message From Socket %p ] <Parse Fail> <%s><%s>", np->socket, hmsg->error_name, hmsg->error_reason);
+				// response 400 then go on
 				if (
 					send_text(
 						np,
-						500,
-						pp->phrase_500,
+						400,
+						pp->phrase_400,
 						1,
-						pp->html_500,
+						pp->html_400,
 						MIME_TYPE_HTML,
 						HTTP_CHARSET_UTF8,
 						0,
@@ -555,24 +1576,54 @@ static DWORD WINAPI connection_run(_In_ LPVOID params_p) {
 					) != 0
 					)
 				{
-					free(message); message = NULL;
-					return error_shutdown(np, params_p, 6);
+					return error_shutdown(np, params_p, 7);
 				}
 			}
 			else
 			{
-				if (!(hmsg.success))
+				LogMe.bt("[ Parsed HTTP Message From Socket %p ] HTTP/%d.%d %.*s %s %lld", np->socket, hmsg->http_major, hmsg->http_minor, (int)hmsg->url.len, hmsg->url.at, getConstHttpMethodNameStr(hmsg->method), hmsg->content_length);
+				LogMe.w("query string list:");
+				printHttpSliceKVs(hmsg->query_string, hmsg->query_string_num);
+				LogMe.w("fragment list:");
+				printHttpSliceKVs(hmsg->url_fragment, hmsg->url_fragment_num);
+				LogMe.w("HTTP header list:");
+				printHttpSliceKVs(hmsg->http_headers, hmsg->http_headers_num);
+				int handled = 0;
+				int handled_error = 1;
+				np->body_remaining = hmsg->content_length > 0 ? hmsg->content_length : 0;
+				// HTTP/1.1 客户端带有 Expect: 100-continue 时先不发送 body：处理函数第一次读取 body 时才回复 100 Continue，
+				// 处理函数不读取 body 就回复（例如拒绝上传）时 body 不会被传输。不支持的 Expect 回复 417，不交给处理函数
+				HttpSlice expect = http_view_header(hmsg, EXPECT_HEADER);
+				int expectation_failed = expect.at && !http_slice_case_equal(expect, EXPECT_100_CONTINUE);
+				np->continue_pending = expect.at && !expectation_failed && np->body_remaining > 0 && (hmsg->http_major > 1 || hmsg->http_minor >= 1);
+				HttpHandler* hdr = expectation_failed ? NULL : http_router_match(router, hmsg->path.at, hmsg->path.len, hmsg->method);
+				if (hdr)
 				{
-					LogMe.et("[ Parsed HTTP Message From Socket %p ] <Parse Fail> <%s><%s>", np->socket, hmsg.error_name, hmsg.error_reason);
-					freeHttpMessage(&hmsg);
-					// response 400 then go on
+					handled = 1;
+					HttpHandlerPac hpac = {
+						.extra = hdr->extra,
+						.node = np,
+						.arena = np->arena
+					};
+					begin_scheduled_request(np, hdr->priority_class);
+					handled_error = ((HTTP_HANDLE_FUNC_TYPE*)hdr->handle_func)(hmsg, &hpac);
+					end_scheduled_request(np);
+				}
+				if (!handled)
+				{
+					// 没有处理函数的请求不读取 body，回复之后由 finish_request_body() 丢弃
+					if (hmsg->content_length > 0)
+					{
+						LogMe.it("[ HTTP Content From Socket %p ] length = %lld | not read", np->socket, hmsg->content_length);
+					}
+					// response 200 (417 for an unsupported expectation) then go on
 					if (
 						send_text(
 							np,
-							400,
-							pp->phrase_400,
+							expectation_failed ? 417 : 200,
+							expectation_failed ? "Expectation Failed" : pp->phrase_200,
 							1,
-							pp->html_400,
+							expectation_failed ? NULL : pp->html_200,
 							MIME_TYPE_HTML,
 							HTTP_CHARSET_UTF8,
 							0,
@@ -580,145 +1631,37 @@ static DWORD WINAPI connection_run(_In_ LPVOID params_p) {
 						) != 0
 						)
 					{
-						free(message); message = NULL;
-						return error_shutdown(np, params_p, 7);
+						return error_shutdown(np, params_p, 8);
 					}
 				}
 				else
 				{
-					LogMe.bt("[ Parsed HTTP Message From Socket %p ] HTTP/%d.%d %s %s %lld", np->socket, hmsg.http_major, hmsg.http_minor, hmsg.url, getConstHttpMethodNameStr(hmsg.method), hmsg.content_length);
-					LogMe.w("query string list:");
-					if (hmsg.query_string)
-						hmsg.query_string->foreach(hmsg.query_string, printHttpHeader, NULL);
-					LogMe.w("fragment list:");
-					if (hmsg.url_fragment)
-						hmsg.url_fragment->foreach(hmsg.url_fragment, printHttpHeader, NULL);
-					LogMe.w("HTTP header list:");
-					if (hmsg.http_headers)
-						hmsg.http_headers->foreach(hmsg.http_headers, printHttpHeader, NULL);
-					int handled = 0;
-					int handled_error = 1;
-					if (http_handlers)
+					if (handled_error < 0)
 					{
-						max_contains mc = {
-							.index = -1,
-							.pattern_str_len = -1,
-							.path = hmsg.path
-						};
-						http_handlers->foreach(http_handlers, testPattern, &mc);
-						if (mc.index >= 0)
-						{
-							handled = 1;
-							HttpHandler* hdr = http_handlers->get(http_handlers, mc.index);
-							HttpHandlerPac hpac = {
-								.extra = hdr->extra,
-								.node = np
-							};
-							handled_error = ((HTTP_HANDLE_FUNC_TYPE*)hdr->handle_func)(&hmsg, &hpac);
-							freeHttpMessage(&hmsg);
-							free(message); message = NULL;
-						}
+						return error_shutdown(np, params_p, handled_error);
 					}
-					if (!handled)
+					else if (handled_error == 0)
 					{
-						long long content_length_f = hmsg.content_length;
-						long long content_length = hmsg.content_length;
-						freeHttpMessage(&hmsg);
-						long recved_content_length = 0;
-						char content[5096] = { 0 };
-						// recv content
-						while (content_length > 0)
-						{
-							long long r_len = content_length > 1024 ? 1024 : content_length;
-							content_length -= r_len;
-							char temp[1024] = { 0 };
-							int r_res = recv_t(np, temp, r_len, 0);
-							if (r_res == 0) {
-								// recv 0 this time
-								break;
-							}
-							else if (r_res == r_len)
-							{
-								if (recved_content_length + r_res < 5096)
-								{
-									memcpy(content + recved_content_length, temp, r_res);
-								}
-								recved_content_length += r_res;
-							}
-							else if (r_res > 0)
-							{
-								// recv a part this time
-								if (recved_content_length + r_res < 5096)
-								{
-									memcpy(content + recved_content_length, temp, r_res);
-								}
-								recved_content_length += r_res;
-								break;
-							}
-							else {
-								free(message); message = NULL;
-								return error_shutdown(np, params_p, 14);
-							}
-						}
-						if (content_length_f > 0)
-						{
-							LogMe.it("[ HTTP Content From Socket %p ] length = %lld | received length = %ld", np->socket, content_length_f, recved_content_length);
-							LogMe.n("%s", content);
-						}
-						// response 200 then go on
-						if (
-							send_text(
-								np,
-								200,
-								pp->phrase_200,
-								1,
-								pp->html_200,
-								MIME_TYPE_HTML,
-								HTTP_CHARSET_UTF8,
-								0,
-								NULL
-							) != 0
-							)
-						{
-							free(message); message = NULL;
-							return error_shutdown(np, params_p, 8);
-						}
+						return recv_0_shutdown(np, params_p, 999);
 					}
-					else
+					else if (handled_error == INT_MAX)
 					{
-						if (handled_error < 0)
-						{
-							return error_shutdown(np, params_p, handled_error);
-						}
-						else if (handled_error == 0)
-						{
-							return recv_0_shutdown(np, params_p, 999);
-						}
-						else if (handled_error == INT_MAX)
-						{
-							return active_shutdown(np, params_p, 9999);
-						}
+						return active_shutdown(np, params_p, 9999);
 					}
 				}
-			}
-		}
-		else if (nres == -1)
-		{
-			if (
-				send_text(
-					np,
-					500,
-					pp->phrase_500,
-					1,
-					pp->html_500,
-					MIME_TYPE_HTML,
-					HTTP_CHARSET_UTF8,
-					0,
-					NULL
-				) != 0
-				)
-			{
-				return error_shutdown(np, params_p, 9);
+				int fres = finish_request_body(np);
+				if (fres < 0)
+				{
+					return error_shutdown(np, params_p, 18);
+				}
+				else if (fres == 1)
+				{
+					return active_shutdown(np, params_p, 19999);
+				}
+				else if (fres == 2)
+				{
+					return recv_0_shutdown(np, params_p, 19);
+				}
 			}
 		}
 		else if (nres == -2)
@@ -743,15 +1686,10 @@ static DWORD WINAPI connection_run(_In_ LPVOID params_p) {
 			}
 			return error_shutdown(np, params_p, 11);
 		}
-		else if (nres == -4)
-		{
-			return error_shutdown(np, params_p, 12);
-		}
 		else
 		{
 			return error_shutdown(np, params_p, 13);
 		}
-		free(message); message = NULL;
 	}
 
 	//size_t read_num = 0;
@@ -820,7 +1758,7 @@ static DWORD WINAPI connection_run(_In_ LPVOID params_p) {
 	//	{
 	//		// recv error
 	//		LogMe.et("recv_t() on socket [ %p ] failed when parsing HTTP request with error: %d", np->socket, WSAGetLastError());
-	//		return error_shutdown(np, params_p, 5);
+	//		return error_shutdown(np, params_p, 6);
 	//	}
 	//}
 	return active_shutdown(np, params_p, -1); // 主动关闭连接
@@ -958,6 +1896,18 @@ void tcp_server_run(int port, int memmory_lack, vlist http_handlers
 		return;
 	}
 
+	// 编译路由表
+	HttpRouter* router = new_http_router();
+	if (router == NULL || (http_handlers && http_handlers->foreach(http_handlers, add_route, router))) {
+		LogMe.et("Unable to build the route table");
+		delete_http_router(router, &router);
+		delete_vlist(server.connections_list, &(server.connections_list));
+		closesocket(ListenSocket);
+		WSACleanup();
+		LogMe.et(exit_words);
+		return;
+	}
+
 	SOCKET ClientSocket;
 	struct sockaddr_storage client_sockaddr;
 	int client_sockaddr_len;
@@ -1011,9 +1961,21 @@ void tcp_server_run(int port, int memmory_lack, vlist http_handlers
 		np->socket = ClientSocket;
 		np->recv_timeout_s = DEFAULT_RECV_TIMEOUT_S;
 		np->send_timeout_s = DEFAULT_SEND_TIMEOUT_S;
+		np->applied_recv_timeout_s = -1;
+		np->applied_send_timeout_s = -1;
+		np->blocking_applied = 0;
+		np->recv_buf = NULL;
+		np->recv_buf_start = np->recv_buf_end = 0;
+		np->http_parser = NULL;
+		np->arena = NULL;
+		np->priority_class = HTTP_PRIORITY_NORMAL;
+		np->applied_thread_priority = THREAD_PRIORITY_NORMAL;
+		np->holds_bulk_slot = 0;
+		np->body_remaining = 0;
+		np->continue_pending = 0;
 		np->open = 1;
 		pp->node_p = np;
-		pp->http_handlers = http_handlers;
+		pp->router = router;
 		pp->phrase_200 = phrase_200;
 		pp->html_200 = html_200;
 		pp->phrase_400 = phrase_400;
@@ -1064,6 +2026,7 @@ void tcp_server_run(int port, int memmory_lack, vlist http_handlers
 
 	// 释放线程列表
 	delete_vlist(server.connections_list, &(server.connections_list));
+	delete_http_router(router, &router);
 
 	closesocket(ListenSocket);
 	WSACleanup();
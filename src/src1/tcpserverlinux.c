@@ -5,8 +5,72 @@
 extern "C" {
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "tcpserverlinux.h"
 
+#include "logme.h"
+#include "vutils.h"
+#include "vlist.h"
+#include "httputils.h"
+#include "vsha256.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#define RFB_SERVER_STATE_NUM (RFBServerState_CLIENT_MESSAGE_AWAIT + 1)
+#define MAX_EPOLL_EVENTS(memory_lack) ((memory_lack) ? 64 : 1024)
+#define MAX_CLOSED_CLIENTS(memory_lack) ((memory_lack) ? 6 : 2000)
+
+// io_uring backend sizes, ring entries MUST be powers of 2
+#define URING_ENTRIES(memory_lack) ((memory_lack) ? 64U : 1024U)
+#define URING_RECV_BUF_NUM(memory_lack) ((memory_lack) ? 32U : 1024U)
+#define URING_RECV_BUF_SIZE(memory_lack) ((memory_lack) ? 2048U : 16384U)
+#define URING_FIXED_BUF_NUM(memory_lack) ((memory_lack) ? 8U : 256U)
+#define URING_FIXED_BUF_SIZE(memory_lack) ((memory_lack) ? 2048U : 16384U)
+#define URING_RECV_BGID 0
+// sendfile() moves at most this many bytes per call
+#define SENDFILE_MAX_CHUNK 0x7ffff000UL
+// pinning the pages costs more than copying small buffers, smaller writes are always copied
+#define ZEROCOPY_MIN_LEN 16384
+// capacity asked for the pipe a request body is spliced through
+#define SINK_PIPE_SIZE (1024 * 1024)
+// size of the buffer a request body is copied through when it can not be spliced
+#define SINK_BUF_SIZE (256 * 1024)
+// the body is received into <file>.part, and renamed to <file> once complete. kept when the client drops, to be resumed
+#define SINK_TEMP_SUFFIX ".part"
+// tells the client how many bytes of an upload have been received
+#define UPLOAD_OFFSET_HEADER "Upload-Offset"
+// the SHA-256 of an upload, checked if the client sends it, and replied
+#define CONTENT_SHA256_HEADER "X-Content-SHA256"
+// the SHA-256 of a received file is saved next to it as <file>.sha256
+#define SINK_DIGEST_SUFFIX ".sha256"
+
 __attribute__ ((weak)) void new_server_property(TCPServer server){
     server->property = NULL;
     server->DeleteProperty = NULL;
@@ -16,6 +80,2702 @@ __attribute__ ((weak)) void new_client_property(TCPClient client){
     client->DeleteProperty = NULL;
 }
 
+volatile struct _______________________TCPServerData_______________________ {
+    int port;
+    bool memory_lack;
+    int listen_fd;
+    int epoll_fd;
+    // written by Stop() to wake up epoll_wait()
+    int wake_fd;
+    // kept open on /dev/null, released for a moment to accept and drop a connection when we run out of fds
+    int idle_fd;
+    volatile bool stop;
+    // closed but still in client_list
+    long closed_clients_num;
+    unsigned long long accepted_clients_total;
+    unsigned long long closed_clients_total;
+    // the CPU the loop is pinned to while running, -1 for not pinned
+    int cpu;
+    // NULL for the epoll backend
+    struct uring_ctx *uring;
+    // the loop drives one file sink at a time, so every sink that can not splice copies through this one buffer, NULL until needed
+    char *sink_buf;
+    Action (*callbacks[RFB_SERVER_STATE_NUM])(TCPClient);
+};
+
+typedef struct write_node {
+    VLISTNODE
+    void *buff;
+    size_t len;
+    size_t written;
+    bool *success;
+    bool *fail;
+    // io_uring backend: the registered buffer the data was copied into, -1 for none
+    int fixed_index;
+    // io_uring backend: the kernel may still be reading buff
+    bool in_flight;
+    // epoll backend: send the bytes with sendfile() from this fd (owned by the node) instead of buff, -1 for none
+    int file_fd;
+    off_t file_offset;
+    // buff is owned by the caller: release(release_arg) is called instead of free(buff)
+    void (*release)(void *);
+    void *release_arg;
+    // epoll backend: send buff with MSG_ZEROCOPY
+    bool zerocopy;
+    // epoll backend: some bytes went out with MSG_ZEROCOPY, the last notification id they used is zerocopy_last
+    bool zerocopy_used;
+    uint32_t zerocopy_last;
+    // epoll backend: the next write follows right away, send with MSG_MORE so they share packets
+    bool more;
+} write_node;
+
+// a request body being received into a file by tcp_receive_file()
+typedef struct file_sink {
+    int file_fd;
+    // for the logs
+    char *filename;
+    // the file being written, NULL after it is renamed to final_path
+    char *temp_path;
+    char *final_path;
+    long long size;
+    long long left;
+    // epoll backend: the socket data is spliced into the file through this pipe, -1 when splice() can not be used
+    int pipe_fds[2];
+    size_t in_pipe;
+    // the data in the pipe is duplicated into this one with tee() to be hashed, while the pipe itself is spliced into the file
+    int tee_fds[2];
+    // bytes at the front of the pipe already hashed
+    size_t hashed_ahead;
+    // the whole file, including what an earlier connection received when resuming
+    vsha256 sha;
+    // the digest the client sent, NULL if none
+    char *expected_sha256;
+    bool keep_alive;
+    const char *phrase200;
+    const char *html200;
+    const char *phrase500;
+    const char *html500;
+} file_sink;
+
+// epoll backend: a caller-owned buffer fully sent with MSG_ZEROCOPY, released when the kernel reports it is done with it
+typedef struct zerocopy_node {
+    VLISTNODE
+    void (*release)(void *);
+    void *release_arg;
+    uint32_t last;
+} zerocopy_node;
+
+// io_uring backend: a provided buffer filled by the multishot recv, waiting for tcp_read()
+typedef struct read_node {
+    VLISTNODE
+    unsigned short bid;
+    size_t len;
+    size_t consumed;
+} read_node;
+
+volatile struct _______________________TCPClientData_______________________ {
+    int fd;
+    TCPServer server;
+    bool open;
+    // edge-triggered readiness: set on EPOLLIN, cleared when recv() hits EAGAIN
+    bool readable;
+    // how the client should be closed once the pending writes are flushed, Action_NO_ACTION while still serving
+    Action closing;
+    unsigned long long read_total;
+    // pending write_node, in order
+    vlist write_queue;
+    // io_uring backend only
+    vlist read_queue;
+    bool recv_armed;
+    bool recv_starved;
+    bool eof;
+    bool recv_error;
+    // requests the kernel has not completed yet, the client can only be freed when it drops to 0
+    int inflight;
+    // epoll backend: SO_ZEROCOPY is set on the fd / could not be set
+    bool zerocopy_enabled;
+    bool zerocopy_unsupported;
+    // epoll backend: notification id of the next MSG_ZEROCOPY send, and every id before zerocopy_done is completed
+    uint32_t zerocopy_next;
+    uint32_t zerocopy_done;
+    // epoll backend: pending zerocopy_node, in order, created on the first MSG_ZEROCOPY send
+    vlist zerocopy_queue;
+    // receiving the request body into a file, the callbacks are not called until it is done. NULL for none
+    file_sink *sink;
+};
+
+static void set_write_flag(bool *flag) {
+    if (flag)
+    {
+        *flag = true;
+    }
+}
+
+static void release_write_node(TCPClientData data, write_node *wn);
+static void end_sink(TCPClientData data, bool discard);
+static void uring_close_client(TCPClient client);
+static bool uring_flush_write_queue(TCPClient client);
+
+static void fail_all_writes(TCPClientData data) {
+    if (!data->write_queue)
+    {
+        return;
+    }
+    // an in-flight buffer is still owned by the kernel, it is failed and freed by its completion
+    long keep = 0;
+    while (data->write_queue->size > keep)
+    {
+        write_node *wn = data->write_queue->get(data->write_queue, keep);
+        if (wn->in_flight)
+        {
+            keep++;
+            continue;
+        }
+        set_write_flag(wn->fail);
+        release_write_node(data, wn);
+        data->write_queue->remove(data->write_queue, keep);
+    }
+}
+
+// release the zerocopy buffers the kernel is done with, or all of them when the client is closed
+static void release_zerocopy_nodes(TCPClientData data, bool all) {
+    while (data->zerocopy_queue && data->zerocopy_queue->size > 0)
+    {
+        zerocopy_node *zn = data->zerocopy_queue->get(data->zerocopy_queue, 0);
+        if (!all && (int32_t) (data->zerocopy_done - zn->last) <= 0)
+        {
+            return;
+        }
+        zn->release(zn->release_arg);
+        data->zerocopy_queue->remove(data->zerocopy_queue, 0);
+    }
+}
+
+// read the MSG_ZEROCOPY notifications from the error queue and release the buffers they complete.
+// return false if the error queue or the socket holds a real error
+static bool reap_zerocopy(TCPClientData data) {
+    while (1)
+    {
+        char control[128];
+        struct msghdr msg = {
+                .msg_control = control,
+                .msg_controllen = sizeof(control)
+        };
+        if (recvmsg(data->fd, &msg, MSG_ERRQUEUE) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            LogMe.et("recvmsg( MSG_ERRQUEUE ) on client [fd = %d ] failed with error: %s", data->fd, strerror(errno));
+            return false;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            struct sock_extended_err *serr = (struct sock_extended_err *) CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+            {
+                LogMe.et("client [fd = %d ] error queue reported error: %s", data->fd, strerror(serr->ee_errno));
+                return false;
+            }
+            // ee_info .. ee_data is the range of completed ids, TCP completes them in order
+            if ((int32_t) (serr->ee_data + 1 - data->zerocopy_done) > 0)
+            {
+                data->zerocopy_done = serr->ee_data + 1;
+            }
+        }
+    }
+    release_zerocopy_nodes(data, false);
+    int so_error = 0;
+    socklen_t so_error_len = sizeof(so_error);
+    if (getsockopt(data->fd, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len) != 0 || so_error != 0)
+    {
+        LogMe.et("client [fd = %d ] failed with error: %s", data->fd, strerror(so_error ? so_error : errno));
+        return false;
+    }
+    return true;
+}
+
+static void close_client(TCPClient client) {
+    TCPClientData data = client->data;
+    if (!data->open)
+    {
+        return;
+    }
+    TCPServer server = data->server;
+    if (server->data->uring)
+    {
+        // cancel the requests still armed on the fd before closing it
+        uring_close_client(client);
+    }
+    // close() also removes the fd from the epoll set
+    if (close(data->fd) != 0)
+    {
+        LogMe.et("close( %d ) failed with error: %s", data->fd, strerror(errno));
+    }
+    fail_all_writes(data);
+    // the kernel may still hold the pages, but nothing will be sent from them any more
+    release_zerocopy_nodes(data, true);
+    // keep what has been received, the client can resume the upload
+    end_sink(data, false);
+    data->open = false;
+    data->readable = false;
+    server->alive_clients_num--;
+    server->data->closed_clients_num++;
+    server->data->closed_clients_total++;
+    LogMe.nt("client [fd = %d ] closed, %d clients alive", data->fd, server->alive_clients_num);
+}
+
+// close the client now if nothing is waiting to be written, otherwise wait for the write queue to be flushed
+static void shutdown_client(TCPClient client, Action action) {
+    TCPClientData data = client->data;
+    if (!data->open)
+    {
+        return;
+    }
+    if (action == Action_ERROR_SHUTDOWN)
+    {
+        LogMe.et("error_shutdown( %d )", data->fd);
+        close_client(client);
+        return;
+    }
+    data->closing = action;
+    data->readable = false;
+    if (data->write_queue->size > 0)
+    {
+        return;
+    }
+    if (action == Action_RECV0_SHUTDOWN)
+    {
+        LogMe.bt("recv_0_shutdown( %d )", data->fd);
+    }
+    else
+    {
+        LogMe.it("active_shutdown( %d )", data->fd);
+    }
+    // be friendly, send FIN after all the data we wanted to send
+    if (shutdown(data->fd, SHUT_WR) != 0)
+    {
+        LogMe.et("shutdown( %d , SHUT_WR ) failed with error: %s", data->fd, strerror(errno));
+    }
+    close_client(client);
+}
+
+// return non-zero to break
+static int free_client(vlist this_vlist, long i, void *extra) {
+    TCPClient client = this_vlist->get(this_vlist, i);
+    close_client(client);
+    if (client->DeleteProperty)
+    {
+        client->DeleteProperty(client->property);
+    }
+    client->property = NULL;
+    delete_vlist(client->data->write_queue, &(client->data->write_queue));
+    delete_vlist(client->data->read_queue, &(client->data->read_queue));
+    delete_vlist(client->data->zerocopy_queue, &(client->data->zerocopy_queue));
+    free((void *) client->data); client->data = NULL;
+    return 0; // go on
+}
+
+// return zero to remove current node from vlist
+static int closed_client_filter(vlist this_vlist, long i, void *extra) {
+    TCPClient client = this_vlist->get(this_vlist, i);
+    if (client->data->open || client->data->inflight > 0)
+    {
+        return 1;
+    }
+    free_client(this_vlist, i, extra);
+    return 0;
+}
+
+static void flush_closed_clients(TCPServer server) {
+    if (server->data->closed_clients_num > MAX_CLOSED_CLIENTS(server->data->memory_lack))
+    {
+        long flushed = server->client_list->flush(server->client_list, closed_client_filter, NULL);
+        server->data->closed_clients_num -= flushed;
+        LogMe.bt("Removed %ld closed clients from client_list", flushed);
+    }
+}
+
+// send the rest of wn until it is done or the socket is full.
+// return 1 if wn is fully sent, 0 on EAGAIN, -1 if the connection is broken
+static int send_write_node(TCPClientData data, write_node *wn) {
+    while (wn->written < wn->len)
+    {
+        size_t rest = wn->len - wn->written;
+        ssize_t s_res;
+        if (wn->file_fd >= 0)
+        {
+            s_res = sendfile(data->fd, wn->file_fd, &wn->file_offset, rest > SENDFILE_MAX_CHUNK ? SENDFILE_MAX_CHUNK : rest);
+            if (s_res == 0)
+            {
+                LogMe.et("sendfile() on client [fd = %d ] reached the end of file [fd = %d ] with %zu bytes left", data->fd, wn->file_fd, rest);
+                return -1;
+            }
+        }
+        else
+        {
+            int flags = MSG_NOSIGNAL | (wn->more ? MSG_MORE : 0) | (wn->zerocopy ? MSG_ZEROCOPY : 0);
+            s_res = send(data->fd, (char *) wn->buff + wn->written, rest, flags);
+            if (s_res > 0 && wn->zerocopy)
+            {
+                // every successful MSG_ZEROCOPY send gets the next notification id
+                wn->zerocopy_used = true;
+                wn->zerocopy_last = data->zerocopy_next++;
+            }
+        }
+        if (s_res >= 0)
+        {
+            wn->written += s_res;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 0;
+        }
+        else if (errno == ENOBUFS && wn->zerocopy)
+        {
+            // out of optmem for the notifications, copy the rest
+            wn->zerocopy = false;
+        }
+        else
+        {
+            LogMe.et("%s on client [fd = %d ] failed with error: %s", wn->file_fd >= 0 ? "sendfile()" : "send()", data->fd, strerror(errno));
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// wn is fully sent: report success and release it, or let it wait for its zerocopy notification
+static void complete_write_node(TCPClientData data, write_node *wn) {
+    set_write_flag(wn->success);
+    if (wn->zerocopy_used)
+    {
+        zerocopy_node zn = {
+                .release = wn->release,
+                .release_arg = wn->release_arg,
+                .last = wn->zerocopy_last
+        };
+        if (!data->zerocopy_queue)
+        {
+            data->zerocopy_queue = make_vlist(sizeof(zerocopy_node));
+        }
+        if (data->zerocopy_queue && data->zerocopy_queue->add(data->zerocopy_queue, &zn) == 0)
+        {
+            wn->release = NULL;
+            wn->buff = NULL;
+        }
+        else
+        {
+            LogMe.et("client [fd = %d ] Malloc failed, zerocopy buffer released before its notification", data->fd);
+        }
+    }
+    release_write_node(data, wn);
+}
+
+// return false if the connection is broken
+static bool flush_write_queue(TCPClient client) {
+    TCPClientData data = client->data;
+    while (data->write_queue->size > 0)
+    {
+        write_node *wn = data->write_queue->get(data->write_queue, 0);
+        int s_res = send_write_node(data, wn);
+        if (s_res == 0)
+        {
+            return true;
+        }
+        else if (s_res < 0)
+        {
+            return false;
+        }
+        complete_write_node(data, wn);
+        data->write_queue->remove(data->write_queue, 0);
+    }
+    return true;
+}
+
+static ReadWriteRes uring_read(TCPClient client, void *buff, size_t buffLen);
+static ReadWriteRes uring_write(TCPClient client, write_node *wn);
+
+ReadWriteRes tcp_read(TCPClient client, void *buff, size_t buffLen) {
+    ReadWriteRes res = {
+            .action = Action_NO_ACTION,
+            .success = false,
+            .sz = 0,
+            .fail_type = FailType_SUCCESS
+    };
+    TCPClientData data = client->data;
+    if (!data->open)
+    {
+        res.action = Action_ERROR_SHUTDOWN;
+        res.fail_type = FailType_CONNECTION_ERROR;
+        return res;
+    }
+    if (data->server->data->uring)
+    {
+        return uring_read(client, buff, buffLen);
+    }
+    ssize_t r_res;
+    while ((r_res = recv(data->fd, buff, buffLen, 0)) < 0 && errno == EINTR);
+    if (r_res > 0)
+    {
+        res.success = true;
+        res.sz = r_res;
+        data->read_total += r_res;
+    }
+    else if (r_res == 0 && buffLen > 0)
+    {
+        LogMe.bt("call recv() on client [fd = %d ] and recv 0", data->fd);
+        data->readable = false;
+        res.action = Action_RECV0_SHUTDOWN;
+        res.fail_type = FailType_PEER_GRACEFUL_SHUTDOWN;
+    }
+    else if (r_res == 0)
+    {
+        res.success = true;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        data->readable = false;
+        res.fail_type = FailType_READ_EAGAIN;
+    }
+    else
+    {
+        LogMe.et("call recv() on client [fd = %d ] with len=%zu failed with error: %s", data->fd, buffLen, strerror(errno));
+        res.action = Action_ERROR_SHUTDOWN;
+        res.fail_type = FailType_CONNECTION_ERROR;
+    }
+    return res;
+}
+
+// send as much of the write described by tmpl as possible right now, queue the rest behind the pending writes.
+// tmpl lives on the caller's stack, it is copied to the heap only when something has to wait
+static ReadWriteRes submit_write(TCPClient client, write_node *tmpl) {
+    ReadWriteRes res = {
+            .action = Action_NO_ACTION,
+            .success = false,
+            .sz = 0,
+            .fail_type = FailType_SUCCESS
+    };
+    TCPClientData data = client->data;
+    if (!data->open || data->closing != Action_NO_ACTION)
+    {
+        set_write_flag(tmpl->fail);
+        release_write_node(data, tmpl);
+        res.action = Action_ERROR_SHUTDOWN;
+        res.fail_type = FailType_CONNECTION_ERROR;
+        return res;
+    }
+    // the io_uring backend never writes synchronously, everything goes through the queue
+    bool uring = data->server->data->uring;
+    // keep the order: if something is already waiting, queue behind it
+    if (!uring && data->write_queue->size == 0)
+    {
+        int s_res = send_write_node(data, tmpl);
+        res.sz = tmpl->written;
+        if (s_res < 0)
+        {
+            set_write_flag(tmpl->fail);
+            release_write_node(data, tmpl);
+            res.action = Action_ERROR_SHUTDOWN;
+            res.fail_type = FailType_CONNECTION_ERROR;
+            return res;
+        }
+        else if (s_res > 0)
+        {
+            complete_write_node(data, tmpl);
+            res.success = true;
+            return res;
+        }
+    }
+    write_node *wn = malloc(sizeof(write_node));
+    if (!wn)
+    {
+        LogMe.et("tcp_write() on client [fd = %d ] Malloc failed", data->fd);
+        set_write_flag(tmpl->fail);
+        release_write_node(data, tmpl);
+        res.action = Action_ERROR_SHUTDOWN;
+        res.fail_type = FailType_CONNECTION_ERROR;
+        return res;
+    }
+    *wn = *tmpl;
+    if (uring)
+    {
+        return uring_write(client, wn);
+    }
+    data->write_queue->quick_add(data->write_queue, wn);
+    // EPOLLOUT is already registered, the rest will be sent when the socket becomes writable again
+    res.fail_type = FailType_WRITE_EAGAIN;
+    return res;
+}
+
+static write_node buffer_write_node(void *buff, size_t buffLen, bool *success, bool *fail) {
+    return (write_node) {
+            .buff = buff,
+            .len = buffLen,
+            .written = 0,
+            .success = success,
+            .fail = fail,
+            .fixed_index = -1,
+            .in_flight = false,
+            .file_fd = -1
+    };
+}
+
+ReadWriteRes tcp_write(TCPClient client, void *buff, size_t buffLen, bool *success, bool *fail) {
+    write_node tmpl = buffer_write_node(buff, buffLen, success, fail);
+    return submit_write(client, &tmpl);
+}
+
+// io_uring backend: read [offset, offset + len) of the file into a heap buffer, NULL on failure. the fd is closed
+static void *read_file_range(int fileFd, off_t offset, size_t len) {
+    char *buff = malloc(len > 0 ? len : 1);
+    size_t got = 0;
+    while (buff && got < len)
+    {
+        ssize_t r_res = pread(fileFd, buff + got, len - got, offset + (off_t) got);
+        if (r_res > 0)
+        {
+            got += r_res;
+        }
+        else if (r_res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            LogMe.et("pread() on file [fd = %d ] failed with error: %s", fileFd, r_res == 0 ? "unexpected end of file" : strerror(errno));
+            free(buff); buff = NULL;
+        }
+    }
+    close(fileFd);
+    return buff;
+}
+
+ReadWriteRes tcp_write_file(TCPClient client, int fileFd, off_t offset, size_t len, bool *success, bool *fail) {
+    if (client->data->server->data->uring)
+    {
+        // the io_uring backend only sends buffers
+        void *buff = read_file_range(fileFd, offset, len);
+        if (!buff)
+        {
+            set_write_flag(fail);
+            return (ReadWriteRes) {.action = Action_ERROR_SHUTDOWN, .success = false, .sz = 0, .fail_type = FailType_CONNECTION_ERROR};
+        }
+        return tcp_write(client, buff, len, success, fail);
+    }
+    write_node tmpl = buffer_write_node(NULL, len, success, fail);
+    tmpl.file_fd = fileFd;
+    tmpl.file_offset = offset;
+    return submit_write(client, &tmpl);
+}
+
+ReadWriteRes tcp_write_zerocopy(TCPClient client, const void *buff, size_t buffLen, void (*release)(void *), void *releaseArg, bool *success, bool *fail) {
+    TCPClientData data = client->data;
+    if (data->server->data->uring)
+    {
+        // the io_uring backend copies into its own buffers anyway
+        void *copy = malloc(buffLen > 0 ? buffLen : 1);
+        if (copy)
+        {
+            memcpy(copy, buff, buffLen);
+        }
+        release(releaseArg);
+        if (!copy)
+        {
+            LogMe.et("tcp_write_zerocopy() on client [fd = %d ] Malloc failed", data->fd);
+            set_write_flag(fail);
+            return (ReadWriteRes) {.action = Action_ERROR_SHUTDOWN, .success = false, .sz = 0, .fail_type = FailType_CONNECTION_ERROR};
+        }
+        return tcp_write(client, copy, buffLen, success, fail);
+    }
+    if (buffLen >= ZEROCOPY_MIN_LEN && data->open && !data->zerocopy_enabled && !data->zerocopy_unsupported)
+    {
+        int one = 1;
+        if (setsockopt(data->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+        {
+            data->zerocopy_enabled = true;
+        }
+        else
+        {
+            LogMe.wt("setsockopt( %d , SO_ZEROCOPY ) failed with error: %s , sending with copies", data->fd, strerror(errno));
+            data->zerocopy_unsupported = true;
+        }
+    }
+    write_node tmpl = buffer_write_node((void *) buff, buffLen, success, fail);
+    tmpl.release = release;
+    tmpl.release_arg = releaseArg;
+    tmpl.zerocopy = buffLen >= ZEROCOPY_MIN_LEN && data->zerocopy_enabled;
+    return submit_write(client, &tmpl);
+}
+
+// tcp_send_text() with extra header lines, each ending with \r\n, NULL for none
+static int send_text_with_headers(TCPClient client, int statusCode, const char *reasonPhrase, bool keepAlive, const char *headerLines, const char *textBody, const char *MIMEType, const char *charset, bool isDownload, const char *downloadFilename) {
+    char header[5000];
+    size_t body_len = textBody ? strlen(textBody) : 0;
+    http_response(header, sizeof(header), statusCode, reasonPhrase, keepAlive, headerLines, body_len, MIMEType, charset, isDownload, downloadFilename);
+    size_t header_len = strlen(header);
+    // the status line, the headers and the body leave in one send()
+    char *resp = malloc(header_len + body_len);
+    if (!resp)
+    {
+        LogMe.et("tcp_send_text() on client [fd = %d ] Malloc failed", client->data->fd);
+        return -1;
+    }
+    memcpy(resp, header, header_len);
+    if (body_len > 0)
+    {
+        memcpy(resp + header_len, textBody, body_len);
+    }
+    return tcp_write(client, resp, header_len + body_len, NULL, NULL).action == Action_NO_ACTION ? 0 : -1;
+}
+
+int tcp_send_text(TCPClient client, int statusCode, const char *reasonPhrase, bool keepAlive, const char *textBody, const char *MIMEType, const char *charset, bool isDownload, const char *downloadFilename) {
+    return send_text_with_headers(client, statusCode, reasonPhrase, keepAlive, NULL, textBody, MIMEType, charset, isDownload, downloadFilename);
+}
+
+// queue the response header of a file, marked to share packets with the body that follows
+static bool write_file_header(TCPClient client, unsigned long long fileSize, bool keepAlive, const char *MIMEType, const char *fileCharset, bool isDownload, const char *downloadFilename, const char *phrase200) {
+    char header[5000];
+    http_response(header, sizeof(header), 200, phrase200, keepAlive, NULL, fileSize, MIMEType, fileCharset, isDownload, downloadFilename);
+    char *buff = substr(header, NULL);
+    if (!buff)
+    {
+        LogMe.et("sending file header to client [fd = %d ] Malloc failed", client->data->fd);
+        return false;
+    }
+    write_node tmpl = buffer_write_node(buff, strlen(buff), NULL, NULL);
+    tmpl.more = true;
+    return submit_write(client, &tmpl).action == Action_NO_ACTION;
+}
+
+int tcp_send_file(TCPClient client, const char *filename, bool keepAlive, const char *MIMEType, const char *fileCharset, bool isDownload, const char *downloadFilename
+        , const char *phrase200
+        , const char *html200
+        , const char *phrase404
+        , const char *html404
+        , const char *phrase500
+        , const char *html500
+) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LogMe.et("tcp_send_file() [client fd = %d ] [file = \"%s\" ] could not open the file due to error: %s", client->data->fd, filename, strerror(errno));
+        return tcp_send_text(client, 404, phrase404, keepAlive, html404, "text/html", "utf-8", false, NULL) == 0 ? 1 : -1;
+    }
+    struct stat st;
+    int stat_res = fstat(fd, &st);
+    if (stat_res != 0 || !S_ISREG(st.st_mode))
+    {
+        LogMe.et("tcp_send_file() [client fd = %d ] [file = \"%s\" ] could not get the file size due to error: %s", client->data->fd, filename, stat_res != 0 ? strerror(errno) : "not a regular file");
+        close(fd);
+        return tcp_send_text(client, 500, phrase500, keepAlive, html500, "text/html", "utf-8", false, NULL) == 0 ? 2 : -1;
+    }
+    LogMe.it("sending file [ \"%s\" ] <Size: %lld> to client [fd = %d ] ...", filename, (long long) st.st_size, client->data->fd);
+    if (!write_file_header(client, st.st_size, keepAlive, MIMEType, fileCharset, isDownload, downloadFilename, phrase200))
+    {
+        close(fd);
+        return -1;
+    }
+    return tcp_write_file(client, fd, 0, st.st_size, NULL, NULL).action == Action_NO_ACTION ? 0 : -1;
+}
+
+int tcp_send_cached_file(TCPClient client, const void *fileData, size_t fileSize, void (*release)(void *), void *releaseArg, bool keepAlive, const char *MIMEType, const char *fileCharset, bool isDownload, const char *downloadFilename
+        , const char *phrase200
+) {
+    if (!write_file_header(client, fileSize, keepAlive, MIMEType, fileCharset, isDownload, downloadFilename, phrase200))
+    {
+        release(releaseArg);
+        return -1;
+    }
+    return tcp_write_zerocopy(client, fileData, fileSize, release, releaseArg, NULL, NULL).action == Action_NO_ACTION ? 0 : -1;
+}
+
+// stop splicing, the rest of the body is copied through the buffer
+static void close_sink_pipes(file_sink *sink) {
+    for (int i = 0; i < 2; i++)
+    {
+        if (sink->pipe_fds[i] >= 0)
+        {
+            close(sink->pipe_fds[i]); sink->pipe_fds[i] = -1;
+        }
+        if (sink->tee_fds[i] >= 0)
+        {
+            close(sink->tee_fds[i]); sink->tee_fds[i] = -1;
+        }
+    }
+}
+
+// end the sink of the client. the unfinished file is removed if {@param discard}, otherwise the data already received is
+// kept in it for the client to resume from
+static void end_sink(TCPClientData data, bool discard) {
+    file_sink *sink = data->sink;
+    if (!sink)
+    {
+        return;
+    }
+    if (sink->pipe_fds[0] >= 0)
+    {
+        // the bytes still in the pipe have been received too
+        while (!discard && sink->file_fd >= 0 && sink->in_pipe > 0)
+        {
+            ssize_t s_res = splice(sink->pipe_fds[0], NULL, sink->file_fd, NULL, sink->in_pipe, SPLICE_F_MOVE);
+            if (s_res < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (s_res <= 0)
+            {
+                break;
+            }
+            sink->in_pipe -= s_res;
+        }
+    }
+    close_sink_pipes(sink);
+    if (sink->file_fd >= 0)
+    {
+        close(sink->file_fd);
+    }
+    if (!discard && sink->temp_path)
+    {
+        LogMe.it("receiving file [ \"%s\" ] interrupted, \"%s\" is kept for resuming", sink->filename, sink->temp_path);
+    }
+    if (discard && sink->temp_path && unlink(sink->temp_path) != 0)
+    {
+        LogMe.et("unlink( %s ) failed with error: %s", sink->temp_path, strerror(errno));
+    }
+    free(sink->filename);
+    free(sink->temp_path);
+    free(sink->final_path);
+    free(sink->expected_sha256);
+    free(sink);
+    data->sink = NULL;
+}
+
+// return false if the file could not be written
+static bool write_to_sink(file_sink *sink, const char *buff, size_t len) {
+    while (len > 0)
+    {
+        ssize_t w_res = write(sink->file_fd, buff, len);
+        if (w_res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (w_res <= 0)
+        {
+            return false;
+        }
+        buff += w_res;
+        len -= w_res;
+    }
+    return true;
+}
+
+// the file system can not splice: copy what is already in the pipe, then stop using it
+static bool drop_sink_pipe(TCPServerData sdata, file_sink *sink) {
+    while (sink->in_pipe > 0)
+    {
+        ssize_t r_res = read(sink->pipe_fds[0], sdata->sink_buf, sink->in_pipe > SINK_BUF_SIZE ? SINK_BUF_SIZE : sink->in_pipe);
+        if (r_res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (r_res <= 0)
+        {
+            return false;
+        }
+        size_t ahead = sink->hashed_ahead < (size_t) r_res ? sink->hashed_ahead : (size_t) r_res;
+        vsha256_update(&sink->sha, sdata->sink_buf + ahead, r_res - ahead);
+        sink->hashed_ahead -= ahead;
+        if (!write_to_sink(sink, sdata->sink_buf, r_res))
+        {
+            return false;
+        }
+        sink->in_pipe -= r_res;
+    }
+    close_sink_pipes(sink);
+    return true;
+}
+
+// hash a copy of the data at the front of the pipe, the data itself stays there to be spliced into the file.
+// return 1 if hashed, 0 if tee() can not be used (nothing is hashed), -1 if the copy can not be read
+static int hash_sink_pipe(TCPServerData sdata, file_sink *sink) {
+    ssize_t t_res;
+    do
+    {
+        t_res = tee(sink->pipe_fds[0], sink->tee_fds[1], sink->in_pipe, SPLICE_F_NONBLOCK);
+    } while (t_res < 0 && errno == EINTR);
+    if (t_res <= 0)
+    {
+        return 0;
+    }
+    // the copy is drained in full, the next tee() starts from an empty pipe
+    size_t left = t_res;
+    while (left > 0)
+    {
+        ssize_t r_res = read(sink->tee_fds[0], sdata->sink_buf, left > SINK_BUF_SIZE ? SINK_BUF_SIZE : left);
+        if (r_res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (r_res <= 0)
+        {
+            return -1;
+        }
+        vsha256_update(&sink->sha, sdata->sink_buf, r_res);
+        left -= r_res;
+    }
+    sink->hashed_ahead = t_res;
+    return 1;
+}
+
+// save the digest of the file as <file>.sha256 in the format of sha256sum
+static bool save_sink_digest(file_sink *sink, const char *hex) {
+    char *digest_path = zero_malloc(strlen(sink->final_path) + strlen(SINK_DIGEST_SUFFIX) + 1);
+    if (!digest_path)
+    {
+        return false;
+    }
+    strcat(digest_path, sink->final_path);
+    strcat(digest_path, SINK_DIGEST_SUFFIX);
+    int fd = open(digest_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    free(digest_path);
+    if (fd < 0)
+    {
+        return false;
+    }
+    char line[VSHA256_HEX_SIZE + 1100];
+    int line_len = snprintf(line, sizeof(line), "%s  %s\n", hex, sink->filename);
+    bool res = line_len > 0 && line_len < (int) sizeof(line) && write(fd, line, line_len) == line_len;
+    return close(fd) == 0 && res;
+}
+
+// move the request body from the socket into the sink file until it is complete or the socket is drained.
+// when the body is complete the sink is ended and 200 is replied, if the file can not be written 500 is replied and the client
+// is closed after it, since the rest of the body can not be told apart from the next request.
+static void drive_sink(TCPClient client) {
+    TCPClientData data = client->data;
+    TCPServerData sdata = data->server->data;
+    file_sink *sink = data->sink;
+    if (!sdata->sink_buf && !(sdata->sink_buf = malloc(SINK_BUF_SIZE)))
+    {
+        LogMe.et("receiving file [ \"%s\" ] from client [fd = %d ] Malloc failed", sink->filename, data->fd);
+        shutdown_client(client, Action_ERROR_SHUTDOWN);
+        return;
+    }
+    while (sink->left > 0 || sink->in_pipe > 0)
+    {
+        if (sink->in_pipe > 0)
+        {
+            if (sink->hashed_ahead == 0)
+            {
+                int h_res = hash_sink_pipe(sdata, sink);
+                if (h_res < 0 || (h_res == 0 && !drop_sink_pipe(sdata, sink)))
+                {
+                    goto file_error;
+                }
+                else if (h_res == 0)
+                {
+                    continue;
+                }
+            }
+            // only what has been hashed leaves the pipe
+            ssize_t s_res = splice(sink->pipe_fds[0], NULL, sink->file_fd, NULL, sink->hashed_ahead, SPLICE_F_MOVE);
+            if (s_res > 0)
+            {
+                sink->in_pipe -= s_res;
+                sink->hashed_ahead -= s_res;
+            }
+            else if (s_res < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (s_res < 0 && errno == EINVAL)
+            {
+                if (!drop_sink_pipe(sdata, sink))
+                {
+                    goto file_error;
+                }
+            }
+            else
+            {
+                goto file_error;
+            }
+            continue;
+        }
+        if (sink->pipe_fds[0] >= 0)
+        {
+            size_t want = sink->left > SINK_PIPE_SIZE ? SINK_PIPE_SIZE : (size_t) sink->left;
+            ssize_t s_res = splice(data->fd, NULL, sink->pipe_fds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (s_res > 0)
+            {
+                sink->left -= s_res;
+                sink->in_pipe += s_res;
+                data->read_total += s_res;
+            }
+            else if (s_res == 0)
+            {
+                LogMe.bt("call splice() on client [fd = %d ] and recv 0", data->fd);
+                shutdown_client(client, Action_RECV0_SHUTDOWN);
+                return;
+            }
+            else if (errno == EINTR)
+            {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                data->readable = false;
+                return;
+            }
+            else if (errno == EINVAL)
+            {
+                // the socket can not be spliced, copy through the buffer instead
+                close_sink_pipes(sink);
+            }
+            else
+            {
+                LogMe.et("call splice() on client [fd = %d ] failed with error: %s", data->fd, strerror(errno));
+                shutdown_client(client, Action_ERROR_SHUTDOWN);
+                return;
+            }
+            continue;
+        }
+        ReadWriteRes r_res = tcp_read(client, sdata->sink_buf, sink->left > SINK_BUF_SIZE ? SINK_BUF_SIZE : (size_t) sink->left);
+        if (r_res.action != Action_NO_ACTION)
+        {
+            shutdown_client(client, r_res.action);
+            return;
+        }
+        else if (!r_res.success)
+        {
+            return;
+        }
+        vsha256_update(&sink->sha, sdata->sink_buf, r_res.sz);
+        if (!write_to_sink(sink, sdata->sink_buf, r_res.sz))
+        {
+            goto file_error;
+        }
+        sink->left -= r_res.sz;
+    }
+    unsigned char digest[VSHA256_DIGEST_SIZE];
+    char hex[VSHA256_HEX_SIZE];
+    vsha256_final(&sink->sha, digest);
+    vsha256_hex(digest, hex);
+    char digest_line[VSHA256_HEX_SIZE + 100];
+    snprintf(digest_line, sizeof(digest_line), CONTENT_SHA256_HEADER ": %s\r\n", hex);
+    bool keep_alive = sink->keep_alive;
+    if (sink->expected_sha256 && !vsha256_hex_equal(digest, sink->expected_sha256, strlen(sink->expected_sha256)))
+    {
+        LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] SHA-256 mismatch, expected %s , received %s", data->fd, sink->filename, sink->expected_sha256, hex);
+        // the body has been read in full, the client can go on after the reply
+        end_sink(data, true);
+        if (send_text_with_headers(client, 400, "Bad Request", keep_alive, digest_line, NULL, NULL, NULL, false, NULL) != 0)
+        {
+            shutdown_client(client, Action_ERROR_SHUTDOWN);
+        }
+        return;
+    }
+    if (close(sink->file_fd) != 0)
+    {
+        sink->file_fd = -1;
+        goto file_error;
+    }
+    sink->file_fd = -1;
+    // the digest is in place by the time the file appears
+    if (!save_sink_digest(sink, hex))
+    {
+        goto file_error;
+    }
+    // the complete file appears under its final name at once
+    if (rename(sink->temp_path, sink->final_path) != 0)
+    {
+        goto file_error;
+    }
+    free(sink->temp_path); sink->temp_path = NULL;
+    LogMe.it("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] completed with file_size = %lld , SHA-256 = %s", data->fd, sink->filename, sink->size, hex);
+    const char *phrase200 = sink->phrase200;
+    const char *html200 = sink->html200;
+    end_sink(data, false);
+    if (send_text_with_headers(client, 200, phrase200, keep_alive, digest_line, html200, "text/html", "utf-8", false, NULL) != 0)
+    {
+        shutdown_client(client, Action_ERROR_SHUTDOWN);
+    }
+    return;
+
+file_error:
+    LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] failed to write to file with error: %s", data->fd, sink->filename, strerror(errno));
+    bool keep_alive_500 = sink->keep_alive;
+    const char *phrase500 = sink->phrase500;
+    const char *html500 = sink->html500;
+    // the file may not hold what was received, do not let the client resume from it
+    end_sink(data, true);
+    shutdown_client(client, tcp_send_text(client, 500, phrase500, keep_alive_500, html500, "text/html", "utf-8", false, NULL) == 0 ? Action_PROACTIVE_SHUTDOWN : Action_ERROR_SHUTDOWN);
+}
+
+// check fileDir and filename and build the final path and the <file>.part path, both freed by the caller. false if invalid
+static bool sink_paths(const char *fileDir, const char *filename, char **path_p, char **temp_path_p) {
+    size_t dir_len = strlen(fileDir);
+    size_t name_len = strlen(filename);
+    *path_p = NULL;
+    *temp_path_p = NULL;
+    if (dir_len == 0 || name_len == 0 || fileDir[dir_len - 1] != '/' || filename[0] == '/' || str_contain_relative_path(fileDir) || str_contain_relative_path(filename))
+    {
+        return false;
+    }
+    char *path = zero_malloc(dir_len + name_len + 1);
+    char *temp_path = zero_malloc(dir_len + name_len + strlen(SINK_TEMP_SUFFIX) + 1);
+    if (!path || !temp_path)
+    {
+        free(path);
+        free(temp_path);
+        return false;
+    }
+    strcat(path, fileDir);
+    strcat(path, filename);
+    strcat(temp_path, path);
+    strcat(temp_path, SINK_TEMP_SUFFIX);
+    *path_p = path;
+    *temp_path_p = temp_path;
+    return true;
+}
+
+// bytes received into <file>.part, -1 if there is none. the preallocation keeps the size, and the file is written in order,
+// so its size is what has been received
+static long long sink_received_size(const char *temp_path) {
+    struct stat st;
+    return stat(temp_path, &st) == 0 ? (long long) st.st_size : -1;
+}
+
+// reply a header only response carrying the Upload-Offset header
+static int send_upload_offset(TCPClient client, int statusCode, const char *reasonPhrase, bool keepAlive, long long offset) {
+    char offset_line[100];
+    snprintf(offset_line, sizeof(offset_line), UPLOAD_OFFSET_HEADER ": %lld\r\n", offset);
+    return send_text_with_headers(client, statusCode, reasonPhrase, keepAlive, offset_line, NULL, NULL, NULL, false, NULL);
+}
+
+int tcp_send_received_file_offset(TCPClient client, const char *fileDir, const char *filename, bool keepAlive
+        , const char *phrase200
+        , const char *phrase404
+) {
+    char *path = NULL;
+    char *temp_path = NULL;
+    long long offset = -1;
+    if (sink_paths(fileDir, filename, &path, &temp_path))
+    {
+        offset = sink_received_size(temp_path);
+    }
+    free(path);
+    free(temp_path);
+    if (offset < 0)
+    {
+        LogMe.it("tcp_send_received_file_offset() [client fd = %d ] [file = \"%s\" ] nothing to resume", client->data->fd, filename);
+        return tcp_send_text(client, 404, phrase404, keepAlive, NULL, NULL, NULL, false, NULL) == 0 ? 1 : -1;
+    }
+    LogMe.it("tcp_send_received_file_offset() [client fd = %d ] [file = \"%s\" ] %lld bytes received", client->data->fd, filename, offset);
+    return send_upload_offset(client, 200, phrase200, keepAlive, offset) == 0 ? 0 : -1;
+}
+
+// hash the first {@param len} bytes of the file, received by an earlier connection
+static bool hash_sink_prefix(TCPServerData sdata, file_sink *sink, long long len) {
+    if (!sdata->sink_buf && !(sdata->sink_buf = malloc(SINK_BUF_SIZE)))
+    {
+        return false;
+    }
+    long long offset = 0;
+    while (offset < len)
+    {
+        ssize_t r_res = pread(sink->file_fd, sdata->sink_buf, len - offset > SINK_BUF_SIZE ? SINK_BUF_SIZE : (size_t) (len - offset), offset);
+        if (r_res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (r_res <= 0)
+        {
+            return false;
+        }
+        vsha256_update(&sink->sha, sdata->sink_buf, r_res);
+        offset += r_res;
+    }
+    return true;
+}
+
+int tcp_receive_file(TCPClient client, const char *fileDir, const char *filename, bool keepAlive, long long fileSize, long long fileOffset, const char *expectedSHA256, const void *received, size_t receivedLen
+        , const char *phrase200
+        , const char *html200
+        , const char *phrase500
+        , const char *html500
+) {
+    TCPClientData data = client->data;
+    char *path = NULL;
+    char *temp_path = NULL;
+    int fd = -1;
+    // a resumed upload may have an empty body: the whole file is there, only the reply was lost
+    if (fileSize < 0 || fileOffset < 0 || (fileSize == 0 && fileOffset == 0) || (size_t) fileSize < receivedLen)
+    {
+        LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] file_size = %lld , file_offset = %lld , error!", data->fd, filename, fileSize, fileOffset);
+        goto handle_500;
+    }
+    if (!sink_paths(fileDir, filename, &path, &temp_path))
+    {
+        goto handle_open_fail;
+    }
+    if (fileOffset > 0)
+    {
+        // resuming: the part file must hold at least fileOffset bytes, otherwise tell the client how many it does hold
+        long long part_size = sink_received_size(temp_path);
+        if (part_size < fileOffset)
+        {
+            LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] file_offset = %lld but %lld bytes received", data->fd, filename, fileOffset, part_size);
+            free(path);
+            free(temp_path);
+            // the body is left unread, the client can not be read from after this reply
+            return send_upload_offset(client, 409, "Conflict", false, part_size > 0 ? part_size : 0) == 0 ? 2 : -1;
+        }
+    }
+    // a resumed file is read back to hash what was received before
+    fd = open(temp_path, O_CREAT | O_CLOEXEC | (fileOffset > 0 ? O_RDWR : O_WRONLY | O_TRUNC), 0644);
+    if (fd < 0)
+    {
+        goto handle_open_fail;
+    }
+    // the bytes after fileOffset are received again
+    if (fileOffset > 0 && (ftruncate(fd, fileOffset) != 0 || lseek(fd, fileOffset, SEEK_SET) < 0))
+    {
+        LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] could not seek to %lld with error: %s", data->fd, filename, fileOffset, strerror(errno));
+        close(fd);
+        goto handle_500;
+    }
+    // reserve the extents up front, the writes then neither grow nor fragment the file. a full disk is refused right away.
+    // the size is kept, so that it always tells how much has been received
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, fileOffset + fileSize) != 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+    {
+        LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] could not preallocate %lld bytes with error: %s", data->fd, filename, fileOffset + fileSize, strerror(errno));
+        close(fd);
+        if (fileOffset == 0)
+        {
+            unlink(temp_path);
+        }
+        goto handle_500;
+    }
+    file_sink *sink = zero_malloc(sizeof(file_sink));
+    char *sink_name = substr(filename, NULL);
+    char *expected = expectedSHA256 ? substr(expectedSHA256, NULL) : NULL;
+    if (!sink || !sink_name || (expectedSHA256 && !expected))
+    {
+        free(sink);
+        free(sink_name);
+        free(expected);
+        close(fd);
+        goto handle_open_fail;
+    }
+    sink->file_fd = fd;
+    sink->filename = sink_name;
+    sink->temp_path = temp_path; temp_path = NULL;
+    sink->final_path = path; path = NULL;
+    sink->size = fileOffset + fileSize;
+    sink->left = fileSize - (long long) receivedLen;
+    sink->pipe_fds[0] = sink->pipe_fds[1] = -1;
+    sink->in_pipe = 0;
+    sink->tee_fds[0] = sink->tee_fds[1] = -1;
+    sink->hashed_ahead = 0;
+    vsha256_init(&sink->sha);
+    sink->expected_sha256 = expected;
+    sink->keep_alive = keepAlive;
+    sink->phrase200 = phrase200;
+    sink->html200 = html200;
+    sink->phrase500 = phrase500;
+    sink->html500 = html500;
+    // with io_uring the data is already in the provided buffers, only the epoll backend can splice from the socket
+    if (!data->server->data->uring && pipe2(sink->pipe_fds, O_NONBLOCK | O_CLOEXEC) == 0 && pipe2(sink->tee_fds, O_NONBLOCK | O_CLOEXEC) == 0)
+    {
+        // a larger pipe means fewer splice() calls, keep the default capacity if it is not allowed.
+        // the tee pipe is as large, so that one tee() copies the whole pipe
+        fcntl(sink->pipe_fds[0], F_SETPIPE_SZ, SINK_PIPE_SIZE);
+        fcntl(sink->tee_fds[0], F_SETPIPE_SZ, SINK_PIPE_SIZE);
+    }
+    else
+    {
+        close_sink_pipes(sink);
+    }
+    data->sink = sink;
+    if (fileOffset > 0 && !hash_sink_prefix(data->server->data, sink, fileOffset))
+    {
+        LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] could not read the first %lld bytes received with error: %s", data->fd, filename, fileOffset, strerror(errno));
+        // what was received is still there, the client may try again
+        end_sink(data, false);
+        goto handle_500;
+    }
+    vsha256_update(&sink->sha, received, receivedLen);
+    if (!write_to_sink(sink, received, receivedLen))
+    {
+        LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] failed to write to file with error: %s", data->fd, filename, strerror(errno));
+        end_sink(data, true);
+        goto handle_500;
+    }
+    LogMe.it("receiving file [ \"%s\" ] <Size: %lld> <Offset: %lld> from client [fd = %d ] ...", filename, fileSize, fileOffset, data->fd);
+    // the rest of the body arrives through the event loop, drive_sink() replies when it is complete
+    drive_sink(client);
+    return data->open ? 0 : -1;
+
+handle_open_fail:
+    LogMe.et("tcp_receive_file() [client fd = %d ] [file = \"%s\" ] could not open the file", data->fd, filename);
+handle_500:
+    free(path);
+    free(temp_path);
+    return tcp_send_text(client, 500, phrase500, keepAlive, html500, "text/html", "utf-8", false, NULL) == 0 ? 1 : -1;
+}
+
+// call the callback of the client's current state until it stops making progress
+static void dispatch_client(TCPServer server, TCPClient client, bool just_accepted) {
+    TCPClientData data = client->data;
+    while (data->open && data->closing == Action_NO_ACTION && (data->readable || just_accepted))
+    {
+        if (data->sink)
+        {
+            // the body of the last request comes first
+            drive_sink(client);
+            if (data->sink)
+            {
+                return;
+            }
+            continue;
+        }
+        RFBServerState state = client->state;
+        Action (*callback)(TCPClient) = server->data->callbacks[state];
+        if (!callback)
+        {
+            LogMe.et("no callback for state %d of client [fd = %d ]", state, data->fd);
+            shutdown_client(client, Action_PROACTIVE_SHUTDOWN);
+            return;
+        }
+        unsigned long long read_before = data->read_total;
+        Action action = callback(client);
+        if (action != Action_NO_ACTION)
+        {
+            shutdown_client(client, action);
+            return;
+        }
+        just_accepted = false;
+        if (data->read_total == read_before && client->state == state)
+        {
+            // waiting for more data, or for the pending writes
+            return;
+        }
+    }
+}
+
+static void handle_client_event(TCPServer server, TCPClient client, uint32_t events) {
+    TCPClientData data = client->data;
+    if (!data->open)
+    {
+        return;
+    }
+    // with MSG_ZEROCOPY, EPOLLERR also reports the notifications waiting in the error queue
+    if ((events & EPOLLERR) && !(data->zerocopy_enabled && reap_zerocopy(data)))
+    {
+        shutdown_client(client, Action_ERROR_SHUTDOWN);
+        return;
+    }
+    if (events & EPOLLOUT)
+    {
+        if (!flush_write_queue(client))
+        {
+            shutdown_client(client, Action_ERROR_SHUTDOWN);
+            return;
+        }
+        if (data->closing != Action_NO_ACTION)
+        {
+            shutdown_client(client, data->closing);
+            return;
+        }
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+    {
+        data->readable = true;
+        dispatch_client(server, client, false);
+    }
+}
+
+// return NULL if malloc failed, in this case the fd is closed
+static TCPClient new_client(TCPServer server, int fd) {
+    TCPClient client = zero_malloc(sizeof(*client));
+    TCPClientData data = zero_malloc(sizeof(*data));
+    vlist write_queue = make_vlist(sizeof(write_node));
+    vlist read_queue = server->data->uring ? make_vlist(sizeof(read_node)) : NULL;
+    if (!client || !data || !write_queue || (server->data->uring && !read_queue))
+    {
+        LogMe.et("[on accept client fd %d ] Malloc failed", fd);
+        close(fd);
+        free((void *) client);
+        free((void *) data);
+        delete_vlist(write_queue, &write_queue);
+        delete_vlist(read_queue, &read_queue);
+        return NULL;
+    }
+    data->fd = fd;
+    data->server = server;
+    data->open = true;
+    data->readable = false;
+    data->closing = Action_NO_ACTION;
+    data->read_total = 0;
+    data->write_queue = write_queue;
+    data->read_queue = read_queue;
+    data->recv_armed = false;
+    data->recv_starved = false;
+    data->eof = false;
+    data->recv_error = false;
+    data->inflight = 0;
+    data->zerocopy_enabled = false;
+    data->zerocopy_unsupported = false;
+    data->zerocopy_next = 0;
+    data->zerocopy_done = 0;
+    data->zerocopy_queue = NULL;
+    data->sink = NULL;
+    client->data = data;
+    client->state = RFBServerState_VERSION_AWAIT;
+    new_client_property(client);
+    return client;
+}
+
+// free a client that has never been attached to the server
+static void delete_client(TCPClient client) {
+    close(client->data->fd);
+    if (client->DeleteProperty)
+    {
+        client->DeleteProperty(client->property);
+    }
+    delete_vlist(client->data->write_queue, &(client->data->write_queue));
+    delete_vlist(client->data->read_queue, &(client->data->read_queue));
+    free((void *) client->data);
+    free((void *) client);
+}
+
+// add the client to client_list, then let the callback of its first state speak
+static void attach_client(TCPServer server, TCPClient client) {
+    server->client_list->quick_add(server->client_list, (void *) client);
+    server->alive_clients_num++;
+    server->data->accepted_clients_total++;
+    LogMe.it("accepted client [fd = %d ], %d clients alive", client->data->fd, server->alive_clients_num);
+    dispatch_client(server, client, true);
+}
+
+static void accept_clients(TCPServer server) {
+    TCPServerData sdata = server->data;
+    while (1)
+    {
+        int fd = accept4(sdata->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            else if ((errno == EMFILE || errno == ENFILE) && sdata->idle_fd >= 0)
+            {
+                // out of fds: the listener is edge-triggered, so drop the connection instead of leaving it in the backlog
+                LogMe.et("accept4() failed with error: %s , dropping the connection", strerror(errno));
+                close(sdata->idle_fd);
+                int drop_fd = accept(sdata->listen_fd, NULL, NULL);
+                if (drop_fd >= 0)
+                {
+                    close(drop_fd);
+                }
+                sdata->idle_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                continue;
+            }
+            else
+            {
+                LogMe.et("accept4() failed with error: %s", strerror(errno));
+                return;
+            }
+        }
+        TCPClient client = new_client(server, fd);
+        if (!client)
+        {
+            continue;
+        }
+        struct epoll_event ev = {
+                .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                .data.ptr = (void *) client
+        };
+        if (epoll_ctl(sdata->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            LogMe.et("epoll_ctl( EPOLL_CTL_ADD , %d ) failed with error: %s", fd, strerror(errno));
+            delete_client(client);
+            continue;
+        }
+        attach_client(server, client);
+    }
+}
+
+/* io_uring backend */
+
+typedef struct uring_ctx {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_sz;
+    void *cq_ptr;
+    size_t cq_sz;
+    size_t sqes_sz;
+    // next free sqe, and the number of sqes not yet handed to io_uring_enter()
+    unsigned sqe_tail;
+    unsigned to_submit;
+    // provided buffers filled by the multishot recv
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_sz;
+    unsigned buf_num;
+    unsigned buf_size;
+    unsigned short buf_ring_tail;
+    char *bufs;
+    bool starved_clients;
+    bool bufs_recycled;
+    // registered buffers used by WRITE_FIXED, free_fixed is a stack of unused indexes
+    char *fixed_bufs;
+    unsigned fixed_num;
+    unsigned fixed_size;
+    int *free_fixed;
+    unsigned free_fixed_num;
+    uint64_t wake_counter;
+    bool accept_armed;
+    bool wake_armed;
+} uring_ctx;
+
+// the low bits of user_data tell what completed, the rest is the TCPServer or the TCPClient
+enum {
+    UringTag_ACCEPT = 1,
+    UringTag_RECV,
+    UringTag_WRITE,
+    UringTag_WAKE,
+    UringTag_CANCEL,
+};
+#define URING_TAG_MASK 7ULL
+#define URING_USER_DATA(ptr, tag) ((uint64_t) (uintptr_t) (ptr) | (uint64_t) (tag))
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// hand the prepared sqes to the kernel, optionally waiting for completions
+static int uring_submit(uring_ctx *ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    int e_res;
+    while ((e_res = sys_io_uring_enter(ring->ring_fd, ring->to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0)) < 0 && errno == EINTR);
+    if (e_res >= 0)
+    {
+        ring->to_submit -= (unsigned) e_res < ring->to_submit ? (unsigned) e_res : ring->to_submit;
+    }
+    return e_res;
+}
+
+static struct io_uring_sqe *uring_get_sqe(uring_ctx *ring) {
+    if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        // the submission queue is full, flush it first
+        if (uring_submit(ring, 0) < 0)
+        {
+            LogMe.et("io_uring_enter() failed with error: %s", strerror(errno));
+        }
+        if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        {
+            return NULL;
+        }
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    ring->to_submit++;
+    return sqe;
+}
+
+static void uring_recycle_buf(uring_ctx *ring, unsigned short bid) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_ring_tail & (ring->buf_num - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (ring->bufs + (size_t) bid * ring->buf_size);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+    ring->buf_ring_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_ring_tail, __ATOMIC_RELEASE);
+    ring->bufs_recycled = true;
+}
+
+static bool uring_arm_accept(TCPServer server) {
+    struct io_uring_sqe *sqe = uring_get_sqe(server->data->uring);
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server->data->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = URING_USER_DATA(server, UringTag_ACCEPT);
+    server->data->uring->accept_armed = true;
+    return true;
+}
+
+static bool uring_arm_wake(TCPServer server) {
+    struct io_uring_sqe *sqe = uring_get_sqe(server->data->uring);
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = server->data->wake_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &server->data->uring->wake_counter;
+    sqe->len = sizeof(uint64_t);
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = URING_USER_DATA(server, UringTag_WAKE);
+    server->data->uring->wake_armed = true;
+    return true;
+}
+
+static bool uring_arm_recv(TCPClient client) {
+    TCPClientData data = client->data;
+    if (!data->open || data->recv_armed || data->eof || data->recv_error)
+    {
+        return true;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(data->server->data->uring);
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = data->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECV_BGID;
+    sqe->user_data = URING_USER_DATA(client, UringTag_RECV);
+    data->recv_armed = true;
+    data->recv_starved = false;
+    data->inflight++;
+    return true;
+}
+
+static void uring_cancel(uring_ctx *ring, uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = (uint64_t) UringTag_CANCEL;
+}
+
+static void uring_close_client(TCPClient client) {
+    TCPClientData data = client->data;
+    uring_ctx *ring = data->server->data->uring;
+    if (ring->ring_fd < 0)
+    {
+        return;
+    }
+    if (data->recv_armed)
+    {
+        uring_cancel(ring, URING_USER_DATA(client, UringTag_RECV));
+    }
+    if (data->write_queue->size > 0 && ((write_node *) data->write_queue->get(data->write_queue, 0))->in_flight)
+    {
+        uring_cancel(ring, URING_USER_DATA(client, UringTag_WRITE));
+    }
+    // the buffers no one will read any more go back to the kernel
+    while (data->read_queue->size > 0)
+    {
+        uring_recycle_buf(ring, ((read_node *) data->read_queue->get(data->read_queue, 0))->bid);
+        data->read_queue->remove(data->read_queue, 0);
+    }
+}
+
+static void release_write_node(TCPClientData data, write_node *wn) {
+    uring_ctx *ring = data->server->data->uring;
+    if (ring && wn->fixed_index >= 0)
+    {
+        ring->free_fixed[ring->free_fixed_num++] = wn->fixed_index;
+        wn->fixed_index = -1;
+    }
+    if (wn->file_fd >= 0)
+    {
+        close(wn->file_fd);
+        wn->file_fd = -1;
+    }
+    if (wn->release)
+    {
+        wn->release(wn->release_arg);
+        wn->release = NULL;
+    }
+    else
+    {
+        free(wn->buff);
+    }
+    wn->buff = NULL;
+}
+
+// submit the head of the write queue if nothing is in flight, only one write per client is in flight to keep the order
+static bool uring_flush_write_queue(TCPClient client) {
+    TCPClientData data = client->data;
+    uring_ctx *ring = data->server->data->uring;
+    while (data->write_queue->size > 0)
+    {
+        write_node *wn = data->write_queue->get(data->write_queue, 0);
+        if (wn->in_flight)
+        {
+            return true;
+        }
+        if (wn->written >= wn->len)
+        {
+            set_write_flag(wn->success);
+            release_write_node(data, wn);
+            data->write_queue->remove(data->write_queue, 0);
+            continue;
+        }
+        struct io_uring_sqe *sqe = uring_get_sqe(ring);
+        if (!sqe)
+        {
+            LogMe.et("no free sqe for client [fd = %d ]", data->fd);
+            return false;
+        }
+        sqe->fd = data->fd;
+        sqe->len = (unsigned) ((wn->len - wn->written) > UINT32_MAX ? UINT32_MAX : (wn->len - wn->written));
+        if (wn->fixed_index >= 0)
+        {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->addr = (uint64_t) (uintptr_t) (ring->fixed_bufs + (size_t) wn->fixed_index * ring->fixed_size + wn->written);
+            sqe->buf_index = (unsigned short) wn->fixed_index;
+            sqe->off = (uint64_t) -1;
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = (uint64_t) (uintptr_t) ((char *) wn->buff + wn->written);
+            sqe->msg_flags = MSG_NOSIGNAL;
+        }
+        sqe->user_data = URING_USER_DATA(client, UringTag_WRITE);
+        wn->in_flight = true;
+        data->inflight++;
+        return true;
+    }
+    return true;
+}
+
+static ReadWriteRes uring_write(TCPClient client, write_node *wn) {
+    ReadWriteRes res = {
+            .action = Action_NO_ACTION,
+            .success = false,
+            .sz = 0,
+            .fail_type = FailType_WRITE_EAGAIN
+    };
+    TCPClientData data = client->data;
+    uring_ctx *ring = data->server->data->uring;
+    if (wn->len == 0)
+    {
+        set_write_flag(wn->success);
+        free(wn->buff);
+        free(wn);
+        res.success = true;
+        res.fail_type = FailType_SUCCESS;
+        return res;
+    }
+    // small writes are copied into a registered buffer so the kernel does not need to map the pages every time
+    if (wn->len <= ring->fixed_size && ring->free_fixed_num > 0)
+    {
+        wn->fixed_index = ring->free_fixed[--ring->free_fixed_num];
+        memcpy(ring->fixed_bufs + (size_t) wn->fixed_index * ring->fixed_size, wn->buff, wn->len);
+    }
+    data->write_queue->quick_add(data->write_queue, wn);
+    if (!uring_flush_write_queue(client))
+    {
+        res.action = Action_ERROR_SHUTDOWN;
+        res.fail_type = FailType_CONNECTION_ERROR;
+    }
+    return res;
+}
+
+static ReadWriteRes uring_read(TCPClient client, void *buff, size_t buffLen) {
+    ReadWriteRes res = {
+            .action = Action_NO_ACTION,
+            .success = false,
+            .sz = 0,
+            .fail_type = FailType_SUCCESS
+    };
+    TCPClientData data = client->data;
+    uring_ctx *ring = data->server->data->uring;
+    while (res.sz < buffLen && data->read_queue->size > 0)
+    {
+        read_node *rn = data->read_queue->get(data->read_queue, 0);
+        size_t n = rn->len - rn->consumed;
+        n = n > buffLen - res.sz ? buffLen - res.sz : n;
+        memcpy((char *) buff + res.sz, ring->bufs + (size_t) rn->bid * ring->buf_size + rn->consumed, n);
+        rn->consumed += n;
+        res.sz += n;
+        if (rn->consumed >= rn->len)
+        {
+            uring_recycle_buf(ring, rn->bid);
+            data->read_queue->remove(data->read_queue, 0);
+        }
+    }
+    if (data->recv_starved)
+    {
+        uring_arm_recv(client);
+    }
+    if (res.sz > 0 || buffLen == 0)
+    {
+        res.success = true;
+        data->read_total += res.sz;
+    }
+    else if (data->recv_error)
+    {
+        res.action = Action_ERROR_SHUTDOWN;
+        res.fail_type = FailType_CONNECTION_ERROR;
+    }
+    else if (data->eof)
+    {
+        LogMe.bt("call recv() on client [fd = %d ] and recv 0", data->fd);
+        data->readable = false;
+        res.action = Action_RECV0_SHUTDOWN;
+        res.fail_type = FailType_PEER_GRACEFUL_SHUTDOWN;
+    }
+    else
+    {
+        data->readable = false;
+        res.fail_type = FailType_READ_EAGAIN;
+    }
+    return res;
+}
+
+static void uring_handle_accept(TCPServer server, int c_res, unsigned flags) {
+    TCPServerData sdata = server->data;
+    if (c_res >= 0)
+    {
+        TCPClient client = new_client(server, c_res);
+        if (client)
+        {
+            attach_client(server, client);
+            if (!uring_arm_recv(client))
+            {
+                shutdown_client(client, Action_ERROR_SHUTDOWN);
+            }
+        }
+    }
+    else if ((c_res == -EMFILE || c_res == -ENFILE) && sdata->idle_fd >= 0)
+    {
+        LogMe.et("io_uring accept failed with error: %s , dropping the connection", strerror(-c_res));
+        close(sdata->idle_fd);
+        int drop_fd = accept(sdata->listen_fd, NULL, NULL);
+        if (drop_fd >= 0)
+        {
+            close(drop_fd);
+        }
+        sdata->idle_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    else if (c_res != -EAGAIN && c_res != -EINTR && c_res != -ECONNABORTED)
+    {
+        LogMe.et("io_uring accept failed with error: %s", strerror(-c_res));
+    }
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        // the multishot accept ended, arm a new one (or on the next Run())
+        sdata->uring->accept_armed = false;
+        if (!sdata->stop)
+        {
+            uring_arm_accept(server);
+        }
+    }
+}
+
+static void uring_handle_recv(TCPServer server, TCPClient client, int c_res, unsigned flags) {
+    TCPClientData data = client->data;
+    uring_ctx *ring = server->data->uring;
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        data->recv_armed = false;
+        data->inflight--;
+    }
+    if (c_res > 0 && (flags & IORING_CQE_F_BUFFER))
+    {
+        unsigned short bid = (unsigned short) (flags >> IORING_CQE_BUFFER_SHIFT);
+        read_node *rn = data->open ? zero_malloc(sizeof(read_node)) : NULL;
+        if (!rn)
+        {
+            uring_recycle_buf(ring, bid);
+            if (data->open)
+            {
+                LogMe.et("io_uring recv on client [fd = %d ] Malloc failed", data->fd);
+                shutdown_client(client, Action_ERROR_SHUTDOWN);
+            }
+            return;
+        }
+        rn->bid = bid;
+        rn->len = (size_t) c_res;
+        rn->consumed = 0;
+        data->read_queue->quick_add(data->read_queue, rn);
+    }
+    else if (c_res == 0)
+    {
+        data->eof = true;
+    }
+    else if (c_res == -ENOBUFS)
+    {
+        // every provided buffer is waiting for tcp_read(), arm again when some are recycled
+        data->recv_starved = true;
+        ring->starved_clients = true;
+    }
+    else if (c_res == -ECANCELED || !data->open)
+    {
+        return;
+    }
+    else if (c_res < 0)
+    {
+        LogMe.et("io_uring recv on client [fd = %d ] failed with error: %s", data->fd, strerror(-c_res));
+        data->recv_error = true;
+    }
+    if (!data->open)
+    {
+        return;
+    }
+    if (!data->recv_armed && !data->recv_starved && !data->eof && !data->recv_error)
+    {
+        uring_arm_recv(client);
+    }
+    data->readable = true;
+    dispatch_client(server, client, false);
+}
+
+static void uring_handle_write(TCPClient client, int c_res) {
+    TCPClientData data = client->data;
+    data->inflight--;
+    write_node *wn = data->write_queue->get(data->write_queue, 0);
+    wn->in_flight = false;
+    if (!data->open)
+    {
+        set_write_flag(wn->fail);
+        release_write_node(data, wn);
+        data->write_queue->remove(data->write_queue, 0);
+        return;
+    }
+    if (c_res < 0 && c_res != -EAGAIN && c_res != -EINTR)
+    {
+        LogMe.et("io_uring send on client [fd = %d ] failed with error: %s", data->fd, strerror(-c_res));
+        shutdown_client(client, Action_ERROR_SHUTDOWN);
+        return;
+    }
+    wn->written += c_res > 0 ? (size_t) c_res : 0;
+    if (!uring_flush_write_queue(client))
+    {
+        shutdown_client(client, Action_ERROR_SHUTDOWN);
+        return;
+    }
+    if (data->closing != Action_NO_ACTION && data->write_queue->size == 0)
+    {
+        shutdown_client(client, data->closing);
+    }
+}
+
+// return non-zero to break
+static int rearm_starved_client(vlist this_vlist, long i, void *extra) {
+    TCPClient client = this_vlist->get(this_vlist, i);
+    if (client->data->open && client->data->recv_starved)
+    {
+        uring_arm_recv(client);
+    }
+    return 0; // go on
+}
+
+static bool uring_loop(TCPServer server) {
+    TCPServerData sdata = server->data;
+    uring_ctx *ring = sdata->uring;
+    if ((!ring->accept_armed && !uring_arm_accept(server)) || (!ring->wake_armed && !uring_arm_wake(server)))
+    {
+        return false;
+    }
+    while (!sdata->stop)
+    {
+        // one syscall submits everything queued by the last batch and waits for the next one
+        if (uring_submit(ring, 1) < 0)
+        {
+            LogMe.et("io_uring_enter() failed with error: %s", strerror(errno));
+            return false;
+        }
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int c_res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+            __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+            void *ptr = (void *) (uintptr_t) (user_data & ~URING_TAG_MASK);
+            switch (user_data & URING_TAG_MASK)
+            {
+                case UringTag_ACCEPT:
+                    uring_handle_accept(server, c_res, flags);
+                    break;
+                case UringTag_RECV:
+                    uring_handle_recv(server, ptr, c_res, flags);
+                    break;
+                case UringTag_WRITE:
+                    uring_handle_write(ptr, c_res);
+                    break;
+                case UringTag_WAKE:
+                    ring->wake_armed = false;
+                    if (!sdata->stop)
+                    {
+                        uring_arm_wake(server);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (ring->starved_clients && ring->bufs_recycled)
+        {
+            ring->starved_clients = false;
+            ring->bufs_recycled = false;
+            server->client_list->foreach(server->client_list, rearm_starved_client, NULL);
+        }
+        flush_closed_clients(server);
+    }
+    return true;
+}
+
+static void uring_exit(TCPServerData sdata) {
+    uring_ctx *ring = sdata->uring;
+    if (!ring)
+    {
+        return;
+    }
+    // closing the ring cancels everything still in flight
+    if (ring->ring_fd >= 0)
+    {
+        close(ring->ring_fd); ring->ring_fd = -1;
+    }
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_sz);
+    }
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_sz);
+    }
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+    {
+        munmap(ring->sq_ptr, ring->sq_sz);
+    }
+    if (ring->buf_ring && ring->buf_ring != MAP_FAILED)
+    {
+        munmap(ring->buf_ring, ring->buf_ring_sz);
+    }
+    free(ring->bufs);
+    free(ring->fixed_bufs);
+    free(ring->free_fixed);
+    free(ring);
+    sdata->uring = NULL;
+}
+
+// return non-zero to break
+static int forget_inflight(vlist this_vlist, long i, void *extra) {
+    TCPClient client = this_vlist->get(this_vlist, i);
+    client->data->inflight = 0;
+    client->data->recv_armed = false;
+    vlist write_queue = client->data->write_queue;
+    for (long w = 0; w < write_queue->size; w++)
+    {
+        ((write_node *) write_queue->get(write_queue, w))->in_flight = false;
+    }
+    return 0; // go on
+}
+
+// set up the ring, the provided buffer ring and the registered buffers, return false if the kernel does not support them
+static bool uring_init(TCPServerData sdata) {
+    uring_ctx *ring = zero_malloc(sizeof(uring_ctx));
+    if (!ring)
+    {
+        return false;
+    }
+    sdata->uring = ring;
+    ring->ring_fd = -1;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // multishot completions can outnumber submissions by far
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENTRIES(sdata->memory_lack) * 4;
+    ring->ring_fd = sys_io_uring_setup(URING_ENTRIES(sdata->memory_lack), &params);
+    if (ring->ring_fd < 0)
+    {
+        LogMe.et("io_uring_setup() failed with error: %s", strerror(errno));
+        goto fail;
+    }
+    ring->sq_entries = params.sq_entries;
+    ring->sq_sz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_sz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_sz = ring->cq_sz = ring->sq_sz > ring->cq_sz ? ring->sq_sz : ring->cq_sz;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        LogMe.et("mmap() for the io_uring submission queue failed with error: %s", strerror(errno));
+        goto fail;
+    }
+    ring->cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ptr :
+                   mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+    ring->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        LogMe.et("mmap() for the io_uring completion queue failed with error: %s", strerror(errno));
+        goto fail;
+    }
+    ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.array);
+    ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + params.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+
+    // provided buffer ring for the multishot recv
+    ring->buf_num = URING_RECV_BUF_NUM(sdata->memory_lack);
+    ring->buf_size = URING_RECV_BUF_SIZE(sdata->memory_lack);
+    ring->buf_ring_sz = sizeof(struct io_uring_buf) * ring->buf_num;
+    ring->buf_ring = mmap(NULL, ring->buf_ring_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->bufs = malloc((size_t) ring->buf_num * ring->buf_size);
+    if (ring->buf_ring == MAP_FAILED || !ring->bufs)
+    {
+        LogMe.et("io_uring provided buffers Malloc failed");
+        goto fail;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring->buf_ring;
+    reg.ring_entries = ring->buf_num;
+    reg.bgid = URING_RECV_BGID;
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        LogMe.et("IORING_REGISTER_PBUF_RING failed with error: %s", strerror(errno));
+        goto fail;
+    }
+    ring->buf_ring_tail = 0;
+    for (unsigned i = 0; i < ring->buf_num; i++)
+    {
+        uring_recycle_buf(ring, (unsigned short) i);
+    }
+    ring->bufs_recycled = false;
+
+    // registered buffers for small writes, not fatal if the memlock limit is too low
+    ring->fixed_num = URING_FIXED_BUF_NUM(sdata->memory_lack);
+    ring->fixed_size = URING_FIXED_BUF_SIZE(sdata->memory_lack);
+    ring->fixed_bufs = malloc((size_t) ring->fixed_num * ring->fixed_size);
+    ring->free_fixed = malloc(sizeof(int) * ring->fixed_num);
+    struct iovec *iovs = malloc(sizeof(struct iovec) * ring->fixed_num);
+    ring->free_fixed_num = 0;
+    if (ring->fixed_bufs && ring->free_fixed && iovs)
+    {
+        for (unsigned i = 0; i < ring->fixed_num; i++)
+        {
+            iovs[i].iov_base = ring->fixed_bufs + (size_t) i * ring->fixed_size;
+            iovs[i].iov_len = ring->fixed_size;
+        }
+        if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iovs, ring->fixed_num) == 0)
+        {
+            for (unsigned i = 0; i < ring->fixed_num; i++)
+            {
+                ring->free_fixed[ring->free_fixed_num++] = (int) (ring->fixed_num - 1 - i);
+            }
+        }
+        else
+        {
+            LogMe.wt("IORING_REGISTER_BUFFERS failed with error: %s , writes will not use registered buffers", strerror(errno));
+        }
+    }
+    free(iovs);
+    if (ring->free_fixed_num == 0)
+    {
+        ring->fixed_size = 0;
+    }
+    return true;
+
+fail:
+    uring_exit(sdata);
+    return false;
+}
+
+static bool epoll_loop(TCPServer server) {
+    TCPServerData sdata = server->data;
+    int max_events = MAX_EPOLL_EVENTS(sdata->memory_lack);
+    struct epoll_event *events = zero_malloc(sizeof(struct epoll_event) * max_events);
+    if (!events)
+    {
+        LogMe.et("event loop on port %d Malloc failed", sdata->port);
+        return false;
+    }
+    while (!sdata->stop)
+    {
+        int n = epoll_wait(sdata->epoll_fd, events, max_events, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LogMe.et("epoll_wait() failed with error: %s", strerror(errno));
+            free(events);
+            return false;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            void *ptr = events[i].data.ptr;
+            if (ptr == (void *) server)
+            {
+                accept_clients(server);
+            }
+            else if (ptr == (void *) sdata)
+            {
+                uint64_t counter;
+                while (read(sdata->wake_fd, &counter, sizeof(counter)) < 0 && errno == EINTR);
+            }
+            else
+            {
+                handle_client_event(server, ptr, events[i].events);
+            }
+        }
+        // a closed client may still be referenced by the batch above, only free them between batches
+        flush_closed_clients(server);
+    }
+    free(events);
+    return true;
+}
+
+static bool server_run(TCPServer server) {
+    TCPServerData sdata = server->data;
+    if (server->status == TCPServerStatus_RUNNING)
+    {
+        LogMe.et("server on port %d is already running", sdata->port);
+        return false;
+    }
+    server->status = TCPServerStatus_RUNNING;
+    LogMe.it("event loop started on port: %d", sdata->port);
+    bool clean_exit = sdata->uring ? uring_loop(server) : epoll_loop(server);
+    clean_exit = clean_exit && sdata->stop;
+    sdata->stop = false;
+    server->status = TCPServerStatus_CREATED;
+    LogMe.it("event loop exited on port: %d", sdata->port);
+    return clean_exit;
+}
+
+static void server_stop(TCPServer server) {
+    server->data->stop = true;
+    uint64_t one = 1;
+    while (write(server->data->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+static void server_add_callback(TCPServer server, RFBServerState state, Action (*callback)(TCPClient)) {
+    if (state < 0 || state >= RFB_SERVER_STATE_NUM)
+    {
+        LogMe.et("AddCallback() with invalid state %d", state);
+        return;
+    }
+    server->data->callbacks[state] = callback;
+}
+
+static void close_server_fds(TCPServerData sdata) {
+    if (sdata->listen_fd >= 0)
+    {
+        close(sdata->listen_fd); sdata->listen_fd = -1;
+    }
+    if (sdata->epoll_fd >= 0)
+    {
+        close(sdata->epoll_fd); sdata->epoll_fd = -1;
+    }
+    if (sdata->wake_fd >= 0)
+    {
+        close(sdata->wake_fd); sdata->wake_fd = -1;
+    }
+    if (sdata->idle_fd >= 0)
+    {
+        close(sdata->idle_fd); sdata->idle_fd = -1;
+    }
+}
+
+static void release_server(TCPServer server);
+
+// return non-zero to break
+static int release_shard(vlist this_vlist, long i, void *extra) {
+    // the shard struct itself is a node of shards, freed by delete_vlist()
+    release_server(this_vlist->get(this_vlist, i));
+    return 0; // go on
+}
+
+// release everything the server holds except the TCPServer struct itself
+static void release_server(TCPServer server) {
+    if (server->shards)
+    {
+        server->shards->foreach(server->shards, release_shard, NULL);
+        delete_vlist(server->shards, &(server->shards));
+    }
+    if (server->data && server->data->uring)
+    {
+        // nothing can complete after the ring is closed
+        close(server->data->uring->ring_fd); server->data->uring->ring_fd = -1;
+        if (server->client_list)
+        {
+            server->client_list->foreach(server->client_list, forget_inflight, NULL);
+        }
+    }
+    if (server->client_list)
+    {
+        server->client_list->foreach(server->client_list, free_client, NULL);
+        delete_vlist(server->client_list, &(server->client_list));
+    }
+    if (server->data)
+    {
+        uring_exit(server->data);
+        close_server_fds(server->data);
+        free(server->data->sink_buf); server->data->sink_buf = NULL;
+        free((void *) server->data); server->data = NULL;
+    }
+    if (server->DeleteProperty)
+    {
+        server->DeleteProperty(server->property);
+    }
+    server->property = NULL;
+}
+
+static void server_destroy(TCPServer server, TCPServer *server_ptr) {
+    if (!server)
+    {
+        return;
+    }
+    release_server(server);
+    free((void *) server);
+    if (server_ptr)
+    {
+        *server_ptr = NULL;
+    }
+}
+
+static void server_get_stats(TCPServer server, TCPServerStats *stats) {
+    if (!stats)
+    {
+        return;
+    }
+    *stats = (TCPServerStats) {
+            .shard_num = 0,
+            .alive_clients_num = 0,
+            .accepted_clients_num = 0,
+            .closed_clients_num = 0
+    };
+    if (!server->shards)
+    {
+        stats->shard_num = 1;
+        stats->alive_clients_num = server->alive_clients_num;
+        stats->accepted_clients_num = server->data->accepted_clients_total;
+        stats->closed_clients_num = server->data->closed_clients_total;
+        return;
+    }
+    for (long i = 0; i < server->shards->size; i++)
+    {
+        TCPServer shard = server->shards->get(server->shards, i);
+        stats->shard_num++;
+        stats->alive_clients_num += shard->alive_clients_num;
+        stats->accepted_clients_num += shard->data->accepted_clients_total;
+        stats->closed_clients_num += shard->data->closed_clients_total;
+    }
+    server->alive_clients_num = stats->alive_clients_num;
+}
+
+// return the listening fd, or -1 on error
+static int open_listen_socket(int port, bool reuse_port) {
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bool ipv6 = fd >= 0;
+    if (!ipv6)
+    {
+        LogMe.wt("IPv6 socket() failed with error: %s , fall back to IPv4", strerror(errno));
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            LogMe.et("Error at socket(): %s", strerror(errno));
+            return -1;
+        }
+    }
+    int on = 1, off = 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0)
+    {
+        LogMe.et("setsockopt for SO_REUSEADDR failed with error: %s", strerror(errno));
+    }
+    // every shard binds its own socket to the same port, the kernel balances new connections among them
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+    {
+        LogMe.et("setsockopt for SO_REUSEPORT failed with error: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    int b_res;
+    if (ipv6)
+    {
+        // IPv4 IPv6 dual stack
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0)
+        {
+            LogMe.et("setsockopt for IPV6_V6ONLY failed with error: %s", strerror(errno));
+        }
+        struct sockaddr_in6 addr = {
+                .sin6_family = AF_INET6,
+                .sin6_port = htons(port),
+                .sin6_addr = in6addr_any
+        };
+        b_res = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    }
+    else
+    {
+        struct sockaddr_in addr = {
+                .sin_family = AF_INET,
+                .sin_port = htons(port),
+                .sin_addr.s_addr = htonl(INADDR_ANY)
+        };
+        b_res = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    }
+    if (b_res != 0)
+    {
+        LogMe.et("bind failed with error: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    LogMe.it("bind succeeded on port: %d", port);
+    if (listen(fd, SOMAXCONN) != 0)
+    {
+        LogMe.et("Listen failed with error: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    LogMe.it("listen succeeded on port: %d", port);
+    return fd;
+}
+
+// create a single event loop, the listening socket uses SO_REUSEPORT if it is a shard
+static TCPServer new_reactor(int port, bool memoryLack, bool reusePort, TCPServerBackend backend) {
+    TCPServer server = zero_malloc(sizeof(*server));
+    TCPServerData sdata = zero_malloc(sizeof(*sdata));
+    vlist client_list = make_vlist(sizeof(struct _______________________TCPClient_______________________));
+    if (!server || !sdata || !client_list)
+    {
+        LogMe.et("new_tcp_server() Malloc failed");
+        free((void *) server);
+        free((void *) sdata);
+        delete_vlist(client_list, &client_list);
+        return NULL;
+    }
+    sdata->port = port;
+    sdata->memory_lack = memoryLack;
+    sdata->stop = false;
+    sdata->closed_clients_num = 0;
+    sdata->accepted_clients_total = 0;
+    sdata->closed_clients_total = 0;
+    sdata->cpu = -1;
+    sdata->uring = NULL;
+    sdata->sink_buf = NULL;
+    sdata->listen_fd = open_listen_socket(port, reusePort);
+    sdata->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    sdata->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sdata->idle_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    server->data = sdata;
+    server->status = TCPServerStatus_CREATED;
+    server->client_list = client_list;
+    server->alive_clients_num = 0;
+    server->shards = NULL;
+    server->shard_index = 0;
+    server->backend = TCPServerBackend_EPOLL;
+    server->AddCallback = server_add_callback;
+    server->Run = server_run;
+    server->Stop = server_stop;
+    server->Destroy = server_destroy;
+    server->GetStats = server_get_stats;
+    new_server_property(server);
+    if (sdata->listen_fd < 0 || sdata->epoll_fd < 0 || sdata->wake_fd < 0)
+    {
+        LogMe.et("new_tcp_server() on port %d failed, epoll_fd = %d , wake_fd = %d", port, sdata->epoll_fd, sdata->wake_fd);
+        server_destroy(server, &server);
+        return NULL;
+    }
+    struct epoll_event listen_ev = {
+            .events = EPOLLIN | EPOLLET,
+            .data.ptr = (void *) server
+    };
+    struct epoll_event wake_ev = {
+            .events = EPOLLIN,
+            .data.ptr = (void *) sdata
+    };
+    if (
+            epoll_ctl(sdata->epoll_fd, EPOLL_CTL_ADD, sdata->listen_fd, &listen_ev) != 0 ||
+            epoll_ctl(sdata->epoll_fd, EPOLL_CTL_ADD, sdata->wake_fd, &wake_ev) != 0
+            )
+    {
+        LogMe.et("epoll_ctl() for the listening socket failed with error: %s", strerror(errno));
+        server_destroy(server, &server);
+        return NULL;
+    }
+    if (backend == TCPServerBackend_IO_URING)
+    {
+        if (uring_init(sdata))
+        {
+            server->backend = TCPServerBackend_IO_URING;
+        }
+        else
+        {
+            LogMe.wt("io_uring is not available, server on port %d falls back to epoll", port);
+        }
+    }
+    return server;
+}
+
+bool new_tcp_server(TCPServer *tcpServer, int port, bool memoryLack, bool runImmediately) {
+    if (!tcpServer)
+    {
+        return false;
+    }
+    *tcpServer = new_reactor(port, memoryLack, false, TCPServerBackend_EPOLL);
+    if (!(*tcpServer))
+    {
+        return false;
+    }
+    if (runImmediately)
+    {
+        return (*tcpServer)->Run(*tcpServer);
+    }
+    return true;
+}
+
+/* sharded server */
+
+static void *shard_thread_run(void *shard_p) {
+    TCPServer shard = shard_p;
+    return shard->Run(shard) ? shard_p : NULL;
+}
+
+static bool sharded_run(TCPServer server) {
+    vlist shards = server->shards;
+    if (server->status == TCPServerStatus_RUNNING)
+    {
+        LogMe.et("sharded server is already running");
+        return false;
+    }
+    server->status = TCPServerStatus_RUNNING;
+    cpu_set_t allowed, old_mask;
+    CPU_ZERO(&allowed);
+    bool pin = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 1;
+    bool restore_mask = pin && pthread_getaffinity_np(pthread_self(), sizeof(old_mask), &old_mask) == 0;
+    // shard i is pinned to the i-th allowed CPU (round-robin if there are more shards than CPUs)
+    int cpu = -1;
+    for (long i = 0; i < shards->size; i++)
+    {
+        TCPServer shard = shards->get(shards, i);
+        shard->data->cpu = -1;
+        if (!pin)
+        {
+            continue;
+        }
+        do
+        {
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        } while (!CPU_ISSET(cpu, &allowed));
+        shard->data->cpu = cpu;
+    }
+    pthread_t *threads = zero_malloc(sizeof(pthread_t) * shards->size);
+    bool *started = zero_malloc(sizeof(bool) * shards->size);
+    bool res = threads && started;
+    // shard 0 runs on the calling thread, the others on their own threads
+    for (long i = 1; res && i < shards->size; i++)
+    {
+        TCPServer shard = shards->get(shards, i);
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (shard->data->cpu >= 0)
+        {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(shard->data->cpu, &mask);
+            pthread_attr_setaffinity_np(&attr, sizeof(mask), &mask);
+        }
+        int c_res = pthread_create(&threads[i], &attr, shard_thread_run, (void *) shard);
+        pthread_attr_destroy(&attr);
+        if (c_res != 0)
+        {
+            LogMe.et("pthread_create() for shard %ld failed with error: %s", i, strerror(c_res));
+            res = false;
+            break;
+        }
+        started[i] = true;
+        LogMe.it("shard %ld started on port %d [cpu = %d ]", i, shard->data->port, shard->data->cpu);
+    }
+    if (res)
+    {
+        TCPServer shard0 = shards->get(shards, 0);
+        if (shard0->data->cpu >= 0)
+        {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(shard0->data->cpu, &mask);
+            pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+        }
+        LogMe.it("shard 0 started on port %d [cpu = %d ]", shard0->data->port, shard0->data->cpu);
+        res = shard0->Run(shard0);
+    }
+    // one shard returned (or failed to start), take the others down too
+    for (long i = 0; i < shards->size; i++)
+    {
+        TCPServer shard = shards->get(shards, i);
+        shard->Stop(shard);
+    }
+    for (long i = 1; threads && started && i < shards->size; i++)
+    {
+        void *t_res = NULL;
+        if (started[i])
+        {
+            pthread_join(threads[i], &t_res);
+            res = res && t_res;
+        }
+    }
+    // Stop() leaves the flag set on the shards that were not running
+    for (long i = 0; i < shards->size; i++)
+    {
+        TCPServer shard = shards->get(shards, i);
+        shard->data->stop = false;
+    }
+    free(threads);
+    free(started);
+    if (restore_mask)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(old_mask), &old_mask);
+    }
+    server->status = TCPServerStatus_CREATED;
+    return res;
+}
+
+static void sharded_stop(TCPServer server) {
+    for (long i = 0; i < server->shards->size; i++)
+    {
+        TCPServer shard = server->shards->get(server->shards, i);
+        shard->Stop(shard);
+    }
+}
+
+static void sharded_add_callback(TCPServer server, RFBServerState state, Action (*callback)(TCPClient)) {
+    for (long i = 0; i < server->shards->size; i++)
+    {
+        TCPServer shard = server->shards->get(server->shards, i);
+        shard->AddCallback(shard, state, callback);
+    }
+}
+
+bool new_tcp_server_sharded(TCPServer *tcpServer, int port, bool memoryLack, bool runImmediately, int shardNum) {
+    return new_tcp_server_with_backend(tcpServer, port, memoryLack, runImmediately, shardNum, TCPServerBackend_EPOLL);
+}
+
+bool new_tcp_server_with_backend(TCPServer *tcpServer, int port, bool memoryLack, bool runImmediately, int shardNum, TCPServerBackend backend) {
+    if (!tcpServer)
+    {
+        return false;
+    }
+    *tcpServer = NULL;
+    if (shardNum == 1)
+    {
+        *tcpServer = new_reactor(port, memoryLack, false, backend);
+        if (!(*tcpServer))
+        {
+            return false;
+        }
+        return runImmediately ? (*tcpServer)->Run(*tcpServer) : true;
+    }
+    if (shardNum <= 0)
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        shardNum = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ? CPU_COUNT(&allowed) : 1;
+        shardNum = shardNum > 0 ? shardNum : 1;
+    }
+    TCPServer server = zero_malloc(sizeof(*server));
+    vlist shards = make_vlist(sizeof(*server));
+    if (!server || !shards)
+    {
+        LogMe.et("new_tcp_server_sharded() Malloc failed");
+        free((void *) server);
+        delete_vlist(shards, &shards);
+        return false;
+    }
+    server->data = NULL;
+    server->status = TCPServerStatus_CREATED;
+    server->client_list = NULL;
+    server->alive_clients_num = 0;
+    server->shards = shards;
+    server->shard_index = -1;
+    server->backend = backend;
+    server->AddCallback = sharded_add_callback;
+    server->Run = sharded_run;
+    server->Stop = sharded_stop;
+    server->Destroy = server_destroy;
+    server->GetStats = server_get_stats;
+    new_server_property(server);
+    for (int i = 0; i < shardNum; i++)
+    {
+        TCPServer shard = new_reactor(port, memoryLack, true, backend);
+        if (!shard)
+        {
+            LogMe.et("new_tcp_server_sharded() failed to create shard %d of %d", i, shardNum);
+            server_destroy(server, &server);
+            return false;
+        }
+        shard->shard_index = i;
+        server->backend = shard->backend;
+        shards->quick_add(shards, (void *) shard);
+    }
+    LogMe.it("sharded server created on port %d with %d shards", port, shardNum);
+    *tcpServer = server;
+    if (runImmediately)
+    {
+        return server->Run(server);
+    }
+    return true;
+}
+
 #ifdef __cplusplus
 }
 #endif
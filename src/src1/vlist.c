@@ -167,7 +167,11 @@ void vlist_clear(vlist this_vlist) {
 }
 
 vlist make_vlist(size_t node_size) {
-    vlist res = malloc(sizeof(struct vlist_struct));
+    return init_vlist(malloc(sizeof(struct vlist_struct)), node_size);
+}
+
+vlist init_vlist(void* vlist_mem, size_t node_size) {
+    vlist res = vlist_mem;
 
     if (res == NULL)
     {
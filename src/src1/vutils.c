@@ -354,7 +354,108 @@ UrlMeta parse_url(const char* url) {
 	}
 }
 
-char* substr(const char* substr_start, const char* substr_end) {
+typedef struct varena_block {
+	struct varena_block* next;
+	size_t size;
+	size_t used;
+} varena_block;
+
+struct varena_struct {
+	varena_block* first;
+	varena_block* current;
+	size_t block_size;
+};
+
+#define VARENA_ALIGN 16
+#define VARENA_ALIGN_UP(n) (((n) + (VARENA_ALIGN - 1)) & ~((size_t)(VARENA_ALIGN - 1)))
+#define VARENA_BLOCK_HEADER_SIZE VARENA_ALIGN_UP(sizeof(varena_block))
+
+static varena_block* new_varena_block(size_t size) {
+	varena_block* block = malloc(VARENA_BLOCK_HEADER_SIZE + size);
+	if (block)
+	{
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+	}
+	return block;
+}
+
+varena make_varena(size_t block_size) {
+	varena arena = zero_malloc(sizeof(struct varena_struct));
+	if (!arena)
+	{
+		return NULL;
+	}
+	arena->block_size = VARENA_ALIGN_UP(block_size > 0 ? block_size : VARENA_ALIGN);
+	arena->first = arena->current = new_varena_block(arena->block_size);
+	if (!arena->first)
+	{
+		free(arena);
+		return NULL;
+	}
+	return arena;
+}
+
+void delete_varena(varena arena, varena* arena_addr) {
+	if (arena)
+	{
+		varena_block* block = arena->first;
+		while (block)
+		{
+			varena_block* next = block->next;
+			free(block);
+			block = next;
+		}
+		free(arena);
+	}
+	if (arena_addr)
+	{
+		*arena_addr = NULL;
+	}
+}
+
+void* varena_alloc(varena arena, size_t n) {
+	n = VARENA_ALIGN_UP(n > 0 ? n : 1);
+	varena_block* block = arena->current;
+	if (block->size - block->used < n)
+	{
+		block = new_varena_block(vmax(arena->block_size, n));
+		if (!block)
+		{
+			return NULL;
+		}
+		arena->current->next = block;
+		arena->current = block;
+	}
+	void* res = (char*)block + VARENA_BLOCK_HEADER_SIZE + block->used;
+	block->used += n;
+	memset(res, 0, n);
+	return res;
+}
+
+void varena_reset(varena arena) {
+	if (!arena)
+	{
+		return;
+	}
+	varena_block* block = arena->first->next;
+	while (block)
+	{
+		varena_block* next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->first->next = NULL;
+	arena->first->used = 0;
+	arena->current = arena->first;
+}
+
+static void* alloc_in(varena arena, size_t n) {
+	return arena ? varena_alloc(arena, n) : zero_malloc(n);
+}
+
+char* varena_substr(varena arena, const char* substr_start, const char* substr_end) {
 	long sub_len = 0;
 	const char* current_ptr = substr_start;
 	while (
@@ -365,7 +466,7 @@ char* substr(const char* substr_start, const char* substr_end) {
 		sub_len++;
 		current_ptr++;
 	}
-	char* res = zero_malloc(sub_len + 1);
+	char* res = alloc_in(arena, sub_len + 1);
 	if (res)
 	{
 		memcpy(res, substr_start, sub_len);
@@ -373,17 +474,34 @@ char* substr(const char* substr_start, const char* substr_end) {
 	return res;
 }
 
+char* substr(const char* substr_start, const char* substr_end) {
+	return varena_substr(NULL, substr_start, substr_end);
+}
+
 static int clear_vstring(vlist this_vlist, long i, void* extra) {
 	free(((vstring*)this_vlist->get(this_vlist, i))->str); *(char**)&((vstring*)this_vlist->get(this_vlist, i))->str = NULL;
 	return 0; // go on
 }
 
-string_list splitf(const char* str, const char *str_end, char delimiter, int first_n) {
+static string_list make_string_list_in(varena arena) {
+	return arena ? init_vlist(varena_alloc(arena, sizeof(struct vlist_struct)), sizeof(vstring)) : make_vlist(sizeof(vstring));
+}
+
+// when the list is allocated from an arena, everything is released by the next varena_reset()
+static void split_malloc_fail(varena arena, string_list p) {
+	if (!arena)
+	{
+		p->foreach(p, clear_vstring, NULL);
+		delete_vlist(p, &p);
+	}
+}
+
+string_list varena_splitf(varena arena, const char* str, const char *str_end, char delimiter, int first_n) {
 	if (first_n < 0)
 	{
 		return NULL;
 	}
-	string_list p = make_vlist(sizeof(vstring));
+	string_list p = make_string_list_in(arena);
 	if (!p) {
 		return NULL;
 	}
@@ -396,15 +514,14 @@ string_list splitf(const char* str, const char *str_end, char delimiter, int fir
 	for (size_t i = 0; i <= c_str_len && (!first_n || p->size < first_n); i++) {
 		if (str[i] == delimiter || !str[i] || i==c_str_len) {
 			de_end_pos = i;
-			vstring* q = zero_malloc(sizeof(vstring));
+			vstring* q = alloc_in(arena, sizeof(vstring));
 			if (!q) {
 			malloc_fail:
-				p->foreach(p, clear_vstring, NULL);
-				delete_vlist(p, &p);
+				split_malloc_fail(arena, p);
 				return NULL;
 			}
 			p->quick_add(p, q);
-			*(char**)&q->str = zero_malloc(sizeof(char) * (de_end_pos + 1 - de_start_pos));
+			*(char**)&q->str = alloc_in(arena, sizeof(char) * (de_end_pos + 1 - de_start_pos));
 			if (!q->str) {
 				goto malloc_fail;
 			}
@@ -415,12 +532,16 @@ string_list splitf(const char* str, const char *str_end, char delimiter, int fir
 	return p;
 }
 
-string_list splitt(const char* str, const char* str_end, char delimiter, int total_n) {
+string_list splitf(const char* str, const char *str_end, char delimiter, int first_n) {
+	return varena_splitf(NULL, str, str_end, delimiter, first_n);
+}
+
+string_list varena_splitt(varena arena, const char* str, const char* str_end, char delimiter, int total_n) {
 	if (total_n < 0)
 	{
 		return NULL;
 	}
-	string_list p = make_vlist(sizeof(vstring));
+	string_list p = make_string_list_in(arena);
 	if (!p) {
 		return NULL;
 	}
@@ -436,15 +557,14 @@ string_list splitt(const char* str, const char* str_end, char delimiter, int tot
 				str[i] == delimiter
 			) || !str[i] || i == c_str_len) {
 			de_end_pos = i;
-			vstring* q = zero_malloc(sizeof(vstring));
+			vstring* q = alloc_in(arena, sizeof(vstring));
 			if (!q) {
 			malloc_fail:
-				p->foreach(p, clear_vstring, NULL);
-				delete_vlist(p, &p);
+				split_malloc_fail(arena, p);
 				return NULL;
 			}
 			p->quick_add(p, q);
-			*(char**)&q->str = zero_malloc(sizeof(char) * (de_end_pos + 1 - de_start_pos));
+			*(char**)&q->str = alloc_in(arena, sizeof(char) * (de_end_pos + 1 - de_start_pos));
 			if (!q->str) {
 				goto malloc_fail;
 			}
@@ -455,6 +575,10 @@ string_list splitt(const char* str, const char* str_end, char delimiter, int tot
 	return p;
 }
 
+string_list splitt(const char* str, const char* str_end, char delimiter, int total_n) {
+	return varena_splitt(NULL, str, str_end, delimiter, total_n);
+}
+
 void delete_string_list(string_list list, string_list* list_addr) {
 	if (list)
 	{